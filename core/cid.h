@@ -27,31 +27,29 @@ namespace core {
 
 constexpr ConnectionId InvalidConnectionId = (ConnectionId)(~0);
 
-static inline ConnectionId BuildConnectionId(uint16_t magic, uint16_t listen_port, uint32_t uid) {
-    uint32_t n = ((uint32_t)magic << 16) | (uint32_t)listen_port;
-    uint64_t r = ((uint64_t)n << 32) | (uint64_t)uid;
+// listen port (16 bits) | generation (24 bits) | slot index (24 bits)
+// A slot gets a new generation every time it is reused, so the
+// id of a closed connection never names the next one.
+constexpr uint32_t GenerationMask = 0xffffff;
+constexpr uint32_t MaxConnectionSlots = 0xffffff;
+
+static inline ConnectionId BuildConnectionId(uint16_t listen_port, uint32_t generation, uint32_t uid) {
+    uint64_t r = ((uint64_t)listen_port << 48)
+        | ((uint64_t)(generation & GenerationMask) << 24)
+        | (uint64_t)(uid & 0xffffff);
     return r;
 }
 
-static inline bool VerifyConnectionId(ConnectionId cid, uint16_t magic) {
-    if (cid == InvalidConnectionId) return false;
-    uint32_t n = (uint32_t)(cid >> 32);
-    uint16_t r = (uint16_t)(n >> 16);
-    return (magic == r);
-}
-
-static inline uint16_t GetMagicNumber(ConnectionId cid) {
-    uint32_t n = (uint32_t)(cid >> 32);
-    return (uint16_t)(n >> 16);
+static inline uint16_t GetListenPort(ConnectionId cid) {
+    return (uint16_t)(cid >> 48);
 }
 
-static inline uint16_t GetListenPort(ConnectionId cid) {
-    uint32_t n = (uint32_t)(cid >> 32);
-    return (uint16_t)(n & 0xffff);;
+static inline uint32_t GetGeneration(ConnectionId cid) {
+    return (uint32_t)(cid >> 24) & GenerationMask;
 }
 
 static inline uint32_t GetUserId(ConnectionId cid) {
-    return (uint32_t)(cid & 0xffffffff);
+    return (uint32_t)(cid & 0xffffff);
 }
 
 }  // namespace core
@@ -0,0 +1,130 @@
+/*
+ *
+ * Copyright (c) 2020 The Raptor Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __RAPTOR_CORE_FRAMING__
+#define __RAPTOR_CORE_FRAMING__
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "raptor/types.h"
+
+namespace raptor {
+namespace core {
+
+// Each check returns -1: error; 0: need more data; > 0: pack_len
+
+constexpr size_t VARINT_MAX_BYTES = 5;  // 35 bits cover INT_MAX
+constexpr size_t DELIMITER_PEEK_SIZE = 64;
+
+inline size_t GetMaxPackageSize(const raptor_framing_t& f) {
+    if (f.max_package_size == 0 || f.max_package_size > INT_MAX) {
+        return INT_MAX;
+    }
+    return f.max_package_size;
+}
+
+inline int CheckFramedLength(const raptor_framing_t& f, size_t header_size, uint64_t length) {
+    uint64_t pack_len = f.length_includes_header ? length : length + header_size;
+    if (pack_len < header_size || pack_len > GetMaxPackageSize(f)) {
+        return -1;
+    }
+    return static_cast<int>(pack_len);
+}
+
+template <typename T, bool BigEndian>
+inline T LoadUInt(const uint8_t* p) {
+    T v = 0;
+    for (size_t i = 0; i < sizeof(T); i++) {
+        if (BigEndian) {
+            v = static_cast<T>((v << 8) | p[i]);
+        } else {
+            v = static_cast<T>(v | (static_cast<T>(p[i]) << (8 * i)));
+        }
+    }
+    return v;
+}
+
+template <typename T, bool BigEndian>
+inline int CheckLengthPrefix(const raptor_framing_t& f, const uint8_t* p, size_t len) {
+    if (len < sizeof(T)) {
+        return 0;
+    }
+    return CheckFramedLength(f, sizeof(T), LoadUInt<T, BigEndian>(p));
+}
+
+inline int CheckVarint(const raptor_framing_t& f, const uint8_t* p, size_t len) {
+    uint64_t v = 0;
+    for (size_t i = 0; i < len && i < VARINT_MAX_BYTES; i++) {
+        v |= static_cast<uint64_t>(p[i] & 0x7f) << (7 * i);
+        if ((p[i] & 0x80) == 0) {
+            return CheckFramedLength(f, i + 1, v);
+        }
+    }
+    return (len >= VARINT_MAX_BYTES) ? -1 : 0;
+}
+
+inline int CheckDelimiter(const raptor_framing_t& f, const uint8_t* p, size_t len) {
+    const uint8_t* e = static_cast<const uint8_t*>(memchr(p, f.delimiter, len));
+    if (e == nullptr) {
+        return (len > GetMaxPackageSize(f)) ? -1 : 0;
+    }
+    return CheckFramedLength(f, 0, static_cast<uint64_t>(e - p + 1));
+}
+
+// Bytes needed to know the length of a package
+inline size_t GetFramingHeaderSize(const raptor_framing_t& f) {
+    switch (f.type) {
+    case RAPTOR_FRAMING_LENGTH16_BE:
+    case RAPTOR_FRAMING_LENGTH16_LE:
+        return sizeof(uint16_t);
+    case RAPTOR_FRAMING_LENGTH32_BE:
+    case RAPTOR_FRAMING_LENGTH32_LE:
+        return sizeof(uint32_t);
+    case RAPTOR_FRAMING_VARINT:
+        return VARINT_MAX_BYTES;
+    case RAPTOR_FRAMING_DELIMITER:
+        return DELIMITER_PEEK_SIZE;
+    default:
+        return 0;
+    }
+}
+
+inline int CheckFraming(const raptor_framing_t& f, const uint8_t* p, size_t len) {
+    switch (f.type) {
+    case RAPTOR_FRAMING_LENGTH16_BE:
+        return CheckLengthPrefix<uint16_t, true>(f, p, len);
+    case RAPTOR_FRAMING_LENGTH16_LE:
+        return CheckLengthPrefix<uint16_t, false>(f, p, len);
+    case RAPTOR_FRAMING_LENGTH32_BE:
+        return CheckLengthPrefix<uint32_t, true>(f, p, len);
+    case RAPTOR_FRAMING_LENGTH32_LE:
+        return CheckLengthPrefix<uint32_t, false>(f, p, len);
+    case RAPTOR_FRAMING_VARINT:
+        return CheckVarint(f, p, len);
+    case RAPTOR_FRAMING_DELIMITER:
+        return CheckDelimiter(f, p, len);
+    default:
+        return -1;
+    }
+}
+
+} // namespace core
+} // namespace raptor
+#endif  // __RAPTOR_CORE_FRAMING__
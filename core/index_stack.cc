@@ -0,0 +1,102 @@
+/*
+ *
+ * Copyright (c) 2020 The Raptor Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "core/index_stack.h"
+#include "util/log.h"
+
+namespace raptor {
+
+constexpr uint32_t IndexStack::InvalidIndex;
+
+static inline uint64_t MakeHead(uint32_t tag, uint32_t index) {
+    return ((uint64_t)tag << 32) | (uint64_t)index;
+}
+
+static inline uint32_t HeadIndex(uint64_t head) {
+    return (uint32_t)(head & 0xffffffff);
+}
+
+static inline uint32_t HeadTag(uint64_t head) {
+    return (uint32_t)(head >> 32);
+}
+
+IndexStack::IndexStack()
+    : _head(MakeHead(0, InvalidIndex))
+    , _next(nullptr)
+    , _size(0)
+    , _capacity(0) {}
+
+IndexStack::~IndexStack() {
+    Destroy();
+}
+
+void IndexStack::Init(uint32_t capacity) {
+    Destroy();
+    _capacity = capacity;
+    _next = new AtomicUInt32[capacity];
+    _head.Store(MakeHead(0, InvalidIndex), MemoryOrder::RELEASE);
+    _size.Store(0);
+}
+
+void IndexStack::Destroy() {
+    delete[] _next;
+    _next = nullptr;
+    _capacity = 0;
+    _size.Store(0);
+    _head.Store(MakeHead(0, InvalidIndex));
+}
+
+void IndexStack::Push(uint32_t index) {
+    RAPTOR_ASSERT(index < _capacity);
+
+    // Count before publishing, so Size() never goes below zero
+    _size.FetchAdd(1, MemoryOrder::RELAXED);
+
+    uint64_t head = _head.Load(MemoryOrder::ACQUIRE);
+    uint64_t desired;
+    do {
+        _next[index].Store(HeadIndex(head), MemoryOrder::RELAXED);
+        desired = MakeHead(HeadTag(head) + 1, index);
+    } while (!_head.CompareExchangeWeak(
+        &head, desired, MemoryOrder::ACQ_REL, MemoryOrder::ACQUIRE));
+}
+
+uint32_t IndexStack::Pop() {
+    uint64_t head = _head.Load(MemoryOrder::ACQUIRE);
+    uint64_t desired;
+    uint32_t index;
+    do {
+        index = HeadIndex(head);
+        if (index == InvalidIndex) {
+            return InvalidIndex;
+        }
+        // _next[index] may be rewritten by a concurrent Pop/Push,
+        // the tag makes the exchange fail in that case.
+        uint32_t next = _next[index].Load(MemoryOrder::RELAXED);
+        desired = MakeHead(HeadTag(head) + 1, next);
+    } while (!_head.CompareExchangeWeak(
+        &head, desired, MemoryOrder::ACQ_REL, MemoryOrder::ACQUIRE));
+    _size.FetchSub(1, MemoryOrder::RELAXED);
+    return index;
+}
+
+uint32_t IndexStack::Size() const {
+    return _size.Load(MemoryOrder::RELAXED);
+}
+
+} // namespace raptor
@@ -0,0 +1,61 @@
+/*
+ *
+ * Copyright (c) 2020 The Raptor Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __RAPTOR_CORE_INDEX_STACK__
+#define __RAPTOR_CORE_INDEX_STACK__
+
+#include <stdint.h>
+#include "util/atomic.h"
+
+namespace raptor {
+
+// Lock-free LIFO stack of the indexes [0, capacity).
+// The links live in a preallocated array, so Push and Pop
+// never allocate. The head carries a tag against ABA.
+class IndexStack final {
+public:
+    static constexpr uint32_t InvalidIndex = static_cast<uint32_t>(-1);
+
+    IndexStack();
+    ~IndexStack();
+
+    IndexStack(const IndexStack&) = delete;
+    IndexStack& operator= (const IndexStack&) = delete;
+
+    // Create an empty stack
+    void Init(uint32_t capacity);
+    void Destroy();
+
+    void Push(uint32_t index);
+
+    // Return InvalidIndex if the stack is empty
+    uint32_t Pop();
+
+    uint32_t Size() const;
+    uint32_t Capacity() const { return _capacity; }
+
+private:
+    // high 32 bits: tag, low 32 bits: index
+    AtomicUInt64 _head;
+    AtomicUInt32* _next;
+    AtomicUInt32 _size;
+    uint32_t _capacity;
+};
+
+} // namespace raptor
+#endif  // __RAPTOR_CORE_INDEX_STACK__
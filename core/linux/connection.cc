@@ -21,6 +21,8 @@
 #include <string.h>
 #include <sys/epoll.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <utility>
 #include "core/linux/epoll_thread.h"
 #include "core/linux/socket_setting.h"
 #include "core/socket_util.h"
@@ -33,14 +35,22 @@
 namespace raptor {
 Connection::Connection(internal::INotificationTransfer* service)
     : _service(service)
-    , _proto(nullptr)
     , _fd(-1)
     , _cid(core::InvalidConnectionId)
     , _rcv_thd(nullptr)
-    , _snd_thd(nullptr) {
+    , _snd_thd(nullptr)
+    , _rcv_block_used(0)
+    , _max_snd_size(0)
+    , _snd_low_watermark(0)
+    , _snd_blocked(false)
+    , _snd_armed(false) {
 
     _user_data = 0;
     _extend_ptr = nullptr;
+    _deadline.Store(0);
+    _idle_timeout = 0;
+    _refs.Store(0);
+    _online.Store(false);
 }
 
 Connection::~Connection() {}
@@ -57,9 +67,6 @@ void Connection::Init(
     _rcv_thd = r;
     _snd_thd = s;
 
-    _rcv_thd->Add(fd, (void*)_cid, EPOLLIN | EPOLLET);
-    _snd_thd->Add(fd, (void*)_cid, EPOLLOUT | EPOLLET);
-
     _addr = *addr;
 
     char* output = nullptr;
@@ -70,79 +77,198 @@ void Connection::Init(
     if (output) {
         Free(output);
     }
+
+    // From here on TcpServer::GetConnection finds it. One reference
+    // for the slot, one for the caller which releases it after Init.
+    _online.Store(true, MemoryOrder::RELAXED);
+    _refs.Store(2, MemoryOrder::RELEASE);
+
+    // Notify first, then no message can be delivered before it
     _service->OnConnectionArrived(_cid, &_addr_str);
+
+    // A send from the OnConnectionArrived path may already have armed
+    // EPOLLOUT, its Modify failed because fd was not registered yet.
+    AutoMutex g(&_snd_mutex);
+    if (!_online.Load(MemoryOrder::RELAXED)) {
+        return;
+    }
+    uint32_t out = _snd_armed ? EPOLLOUT : 0;
+    if (IsSingleEventLoop()) {
+        _rcv_thd->Add(fd, (void*)_cid, EPOLLIN | out | EPOLLET);
+    } else {
+        _rcv_thd->Add(fd, (void*)_cid, EPOLLIN | EPOLLET);
+        _snd_thd->Add(fd, (void*)_cid, out | EPOLLET);
+    }
 }
 
 void Connection::SetProtocol(IProtocol* p) {
-    _proto = p;
+    _parser.SetProtocol(p);
+}
+
+void Connection::SetSendBufferLimit(size_t max_size, size_t low_watermark) {
+    _max_snd_size = max_size;
+    _snd_low_watermark = low_watermark;
 }
 
 bool Connection::SendWithHeader(const void* hdr, size_t hdr_len, const void* data, size_t data_len) {
     if (!IsOnline()) return false;
-    AutoMutex g(&_snd_mutex);
+    Slice h, d;
     if (hdr != nullptr && hdr_len > 0) {
-        _snd_buffer.AddSlice(Slice(hdr, hdr_len));
+        h = Slice(hdr, hdr_len);
     }
     if (data != nullptr && data_len > 0) {
-        _snd_buffer.AddSlice(Slice(data, data_len));
+        d = Slice(data, data_len);
     }
-    _snd_thd->Modify(_fd, (void*)_cid, EPOLLOUT | EPOLLET);
-    return true;
+    return SendSlices(std::move(h), std::move(d));
 }
 
-void Connection::Shutdown(bool notify) {
-    if (_fd < 0) {
-        return;
+bool Connection::SendSlice(const Slice& s) {
+    if (!IsOnline()) return false;
+    return SendSlices(Slice(), Slice(s));
+}
+
+bool Connection::SendSlices(Slice&& hdr, Slice&& data) {
+    AutoMutex g(&_snd_mutex);
+    if (!_online.Load(MemoryOrder::RELAXED)) {
+        return false;
     }
 
-    _rcv_thd->Delete(_fd, EPOLLIN | EPOLLET);
-    _snd_thd->Delete(_fd, EPOLLOUT | EPOLLET);
+    // A single message larger than the limit is still accepted
+    // when nothing is pending, otherwise it could never be sent.
+    size_t pending = _snd_buffer.GetBufferLength();
+    if (_max_snd_size > 0 && pending > 0
+        && pending + hdr.size() + data.size() > _max_snd_size) {
+        _snd_blocked = true;
+        return false;
+    }
 
-    if (notify) {
-        _service->OnConnectionClosed(_cid);
+    _snd_buffer.AddSlice(std::move(hdr));
+    _snd_buffer.AddSlice(std::move(data));
+
+    // Data already pending is waiting for the armed EPOLLOUT,
+    // that event also sends this one.
+    if (pending > 0) {
+        return true;
     }
 
-    raptor_set_socket_shutdown(_fd);
-    _fd = -1;
+    // Write from the calling thread, EPOLLOUT is only needed for
+    // what the kernel did not take. After an error the data is left
+    // queued, OnSend meets the same error and closes the connection.
+    // No epoll event follows a write that went through, so the
+    // idle deadline is refreshed here, otherwise push-only peers
+    // would time out.
+    if (FlushSendBuffer() == 0) {
+        SetDeadline(Now() + _idle_timeout);
+    }
+    if (!_snd_buffer.Empty()) {
+        SetSendInterest(true);
+    }
+    return true;
+}
 
-    memset(&_addr, 0, sizeof(_addr));
+// _snd_mutex must be held
+void Connection::SetSendInterest(bool armed) {
+    if (_snd_armed == armed) {
+        return;
+    }
+    _snd_armed = armed;
+    uint32_t out = armed ? EPOLLOUT : 0;
+    if (IsSingleEventLoop()) {
+        _snd_thd->Modify(_fd, (void*)_cid, EPOLLIN | out | EPOLLET);
+    } else {
+        _snd_thd->Modify(_fd, (void*)_cid, out | EPOLLET);
+    }
+}
 
-    ReleaseBuffer();
+// Only the first call shuts the connection down. The fd is left open
+// until Recycle, a thread still using it cannot hit a reused fd.
+bool Connection::Shutdown(bool notify) {
+    {
+        AutoMutex g(&_snd_mutex);
+        if (!_online.Load(MemoryOrder::RELAXED)) {
+            return false;
+        }
+        _online.Store(false, MemoryOrder::RELAXED);
 
-    _user_data = 0;
-    _extend_ptr = nullptr;
+        if (IsSingleEventLoop()) {
+            _rcv_thd->Delete(_fd, EPOLLIN | EPOLLOUT | EPOLLET);
+        } else {
+            _rcv_thd->Delete(_fd, EPOLLIN | EPOLLET);
+            _snd_thd->Delete(_fd, EPOLLOUT | EPOLLET);
+        }
+        shutdown(_fd, SHUT_RDWR);
+        _snd_buffer.ClearBuffer();
+    }
+
+    if (notify) {
+        _service->OnConnectionClosed(_cid);
+    }
+    return true;
 }
 
 bool Connection::IsOnline() {
-    return (_fd > 0);
+    return _online.Load(MemoryOrder::RELAXED);
 }
 
 const raptor_resolved_address* Connection::GetAddress() {
     return &_addr;
 }
 
-void Connection::ReleaseBuffer() {
-    {
-        AutoMutex g(&_snd_mutex);
-        _snd_buffer.ClearBuffer();
-    }
-    {
-        AutoMutex g(&_rcv_mutex);
-        _rcv_buffer.ClearBuffer();
-    }
+void Connection::Recycle() {
+    raptor_set_socket_shutdown(_fd);
+    _fd = -1;
+    _cid = core::InvalidConnectionId;
+
+    _parser.Reset();
+    _rcv_buffer.ClearBuffer();
+    _rcv_block = Slice();
+    _rcv_block_used = 0;
+
+    _snd_buffer.ClearBuffer();
+    _snd_blocked = false;
+    _snd_armed = false;
+
+    memset(&_addr, 0, sizeof(_addr));
+    _addr_str = Slice();
+    _user_data = 0;
+    _extend_ptr = nullptr;
 }
 
 bool Connection::DoRecvEvent() {
     int result = OnRecv();
+    if (result == 1) {
+        return true;
+    }
     if (result == 0) {
-        _rcv_thd->Modify(_fd, (void*)_cid, EPOLLIN | EPOLLET);
+        // Edge triggered, the shared registration needs no re-arming
+        if (!IsSingleEventLoop()) {
+            _rcv_thd->Modify(_fd, (void*)_cid, EPOLLIN | EPOLLET);
+        }
         return true;
     }
     return false;
 }
 
+// Re-arm EPOLLIN, epoll reports the event again if data is pending
+void Connection::ResumeRecv() {
+    if (!IsOnline()) return;
+    if (IsSingleEventLoop()) {
+        AutoMutex g(&_snd_mutex);
+        uint32_t out = _snd_armed ? EPOLLOUT : 0;
+        _rcv_thd->Modify(_fd, (void*)_cid, EPOLLIN | out | EPOLLET);
+    } else {
+        _rcv_thd->Modify(_fd, (void*)_cid, EPOLLIN | EPOLLET);
+    }
+}
+
 bool Connection::DoSendEvent() {
-    int result = OnSend();
+    bool writable = false;
+    int result = OnSend(&writable);
+
+    // notify outside _snd_mutex, the callback may send again
+    if (writable) {
+        _service->OnConnectionWritable(_cid);
+    }
     if (result == 0) {
         return true;
     }
@@ -150,14 +276,16 @@ bool Connection::DoSendEvent() {
 }
 
 int Connection::OnRecv() {
-    AutoMutex g(&_rcv_mutex);
-
     int recv_bytes = 0;
     int unused_space = 0;
     do {
-        char buffer[8192];
+        if (_rcv_block.size() - _rcv_block_used < RECV_BLOCK_MIN_SPACE) {
+            _rcv_block = MakeSliceByLength(RECV_BLOCK_SIZE);
+            _rcv_block_used = 0;
+        }
 
-        unused_space = sizeof(buffer);
+        uint8_t* buffer = _rcv_block.Buffer() + _rcv_block_used;
+        unused_space = static_cast<int>(_rcv_block.size() - _rcv_block_used);
         recv_bytes = ::recv(_fd, buffer, unused_space, 0);
 
         if (recv_bytes == 0) {
@@ -166,108 +294,113 @@ int Connection::OnRecv() {
 
         if (recv_bytes < 0) {
             if (errno == EINTR || errno == EWOULDBLOCK || errno == EAGAIN) {
+                ReleaseRecvBlock();
                 return 0;
             }
             return -1;
         }
 
-        // Add to recv buffer
-        _rcv_buffer.AddSlice(Slice(buffer, recv_bytes));
+        // Add to recv buffer without copying
+        _rcv_buffer.AddSlice(MakeSubSlice(_rcv_block, _rcv_block_used, recv_bytes));
+        _rcv_block_used += recv_bytes;
         if (ParsingProtocol() == -1) {
             return -1;
         }
 
+        // Leave the rest in the kernel while the dispatch queue is full
+        if (_service->DeferRecv(_cid)) {
+            return 1;
+        }
     } while (recv_bytes == unused_space);
+    ReleaseRecvBlock();
     return 0;
 }
 
-int Connection::OnSend() {
+// Drained, an idle connection keeps no recv block unless a
+// partial package in _rcv_buffer still references it
+void Connection::ReleaseRecvBlock() {
+    if (_rcv_buffer.Empty()) {
+        _rcv_block = Slice();
+        _rcv_block_used = 0;
+    }
+}
+
+void Connection::CheckWritable(bool* writable) {
+    if (_snd_blocked && _snd_buffer.GetBufferLength() <= _snd_low_watermark) {
+        _snd_blocked = false;
+        *writable = true;
+    }
+}
+
+// Sends run on application threads too, whose stacks may be small.
+// A longer send buffer takes several sendmsg calls.
+constexpr size_t MAX_IOVEC_COUNT = 64;
+
+int Connection::OnSend(bool* writable) {
     AutoMutex g(&_snd_mutex);
+    if (FlushSendBuffer() != 0) {
+        return -1;
+    }
+    // Drained, stop the wakeups for every freed window
     if (_snd_buffer.Empty()) {
-        return 0;
+        SetSendInterest(false);
     }
+    CheckWritable(writable);
+    return 0;
+}
 
-    size_t count = 0;
-    do {
+// Write until _snd_buffer is empty or the kernel buffer is full,
+// returns -1 on error. _snd_mutex must be held.
+int Connection::FlushSendBuffer() {
+    // Gather as many slices as possible into one sendmsg, headers
+    // and bodies are separate slices so this halves the syscalls.
+    struct iovec iov[MAX_IOVEC_COUNT];
+    while (!_snd_buffer.Empty()) {
+        size_t count = 0;
+        for (const Slice& s : _snd_buffer) {
+            iov[count].iov_base = const_cast<uint8_t*>(s.begin());
+            iov[count].iov_len = s.size();
+            if (++count == MAX_IOVEC_COUNT) {
+                break;
+            }
+        }
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
 
-        Slice slice = _snd_buffer.GetTopSlice();
-        int slen = ::send(_fd, slice.begin(), slice.size(), 0);
+        // Sends also run on application threads, SIGPIPE must not fire
+        ssize_t slen = ::sendmsg(_fd, &msg, MSG_NOSIGNAL);
 
         if (slen == 0) {
             return -1;
         }
 
         if (slen < 0) {
-            if (errno == EINTR || errno == EWOULDBLOCK || errno == EAGAIN) {
-                return 0;
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EWOULDBLOCK || errno == EAGAIN) {
+                break;
             }
             return -1;
         }
 
         _snd_buffer.MoveHeader((size_t)slen);
-        count = _snd_buffer.Count();
-
-    } while (count > 0);
-    return 0;
-}
-
-bool Connection::ReadSliceFromRecvBuffer(size_t read_size, Slice& s) {
-    size_t cache_size = _rcv_buffer.GetBufferLength();
-    if (read_size >= cache_size) {
-        s = _rcv_buffer.Merge();
-        return true;
     }
-    s = _rcv_buffer.GetHeader(read_size);
-    return false;
+    return 0;
 }
 
 int Connection::ParsingProtocol() {
-    size_t cache_size = _rcv_buffer.GetBufferLength();
-    size_t header_size = _proto->GetMaxHeaderSize();
     int package_counter = 0;
-
-    while (cache_size > 0) {
-        size_t read_size = header_size;
-        int pack_len = 0;
-        Slice package;
-        do {
-            bool reach_tail = ReadSliceFromRecvBuffer(read_size, package);
-            pack_len = _proto->CheckPackageLength(package.begin(), package.size());
-            if (pack_len < 0) {
-                log_error("tcp client: internal protocol error(pack_len = %d)", pack_len);
-                return -1;
-            }
-
-            // equal 0 means we need more data
-            if (pack_len == 0) {
-                if (reach_tail) {
-                    goto done;
-                }
-                read_size *= 2;
-                continue;
-            }
-
-            // We got the length of a whole packet
-            if (cache_size >= (size_t)pack_len) {
-                break;
-            }
-            goto done;
-        } while (false);
-
-        if (package.size() < static_cast<size_t>(pack_len)) {
-            package = _rcv_buffer.GetHeader(pack_len);
-        } else {
-            size_t n = package.size() - pack_len;
-            package.CutTail(n);
-        }
-        _service->OnDataReceived(_cid, &package);
-        _rcv_buffer.MoveHeader(pack_len);
-
-        cache_size = _rcv_buffer.GetBufferLength();
+    Slice package;
+    int r = 0;
+    while ((r = _parser.Next(&_rcv_buffer, &package)) > 0) {
+        _service->OnDataReceived(_cid, std::move(package));
         package_counter++;
     }
-done:
-    return package_counter;
+    return (r < 0) ? -1 : package_counter;
 }
 
 void Connection::SetUserData(void* ptr) {
@@ -19,9 +19,14 @@
 #ifndef __RAPTOR_CORE_LINUX_CONNECTION__
 #define __RAPTOR_CORE_LINUX_CONNECTION__
 
+#include <time.h>
+
+#include "core/package_parser.h"
 #include "core/resolve_address.h"
 #include "core/service.h"
 #include "core/slice/slice_buffer.h"
+#include "util/alloc.h"
+#include "util/atomic.h"
 #include "util/sync.h"
 
 namespace raptor {
@@ -29,8 +34,20 @@ namespace raptor {
 class IProtocol;
 class SendRecvThread;
 
-class Connection {
+// A Connection object stays in its TcpServer slot and is reused
+// in place for the next connection of that slot, see Recycle.
+class Connection : public AllocatedObject {
     friend class TcpServer;
+
+    // recv reads into the tail of a block of this size, a new
+    // block is started when less than RECV_BLOCK_MIN_SPACE is left.
+    // It is dropped once the socket is drained and no partial
+    // package is buffered. Slightly below 16 KB so it fits the 16 KB slab class.
+    enum {
+        RECV_BLOCK_SIZE = 16384 - 64,
+        RECV_BLOCK_MIN_SPACE = 1024,
+    };
+
 public:
     explicit Connection(internal::INotificationTransfer* service);
     ~Connection();
@@ -42,12 +59,22 @@ public:
             SendRecvThread* rcv, SendRecvThread* snd);
 
     void SetProtocol(IProtocol* p);
+    void SetSendBufferLimit(size_t max_size, size_t low_watermark);
     bool SendWithHeader(
         const void* hdr, size_t hdr_len, const void* data, size_t data_len);
-    void Shutdown(bool notify = false);
+    // Queue a reference of s, the bytes are not copied
+    bool SendSlice(const Slice& s);
+    // Return false if it was shut down already
+    bool Shutdown(bool notify = false);
     bool IsOnline();
     const raptor_resolved_address* GetAddress();
     ConnectionId Id() const { return _cid; }
+
+    // idle timeout, refreshed by every recv/send event
+    // and by every direct write that succeeds
+    void SetIdleTimeout(time_t seconds) { _idle_timeout = seconds; }
+    void SetDeadline(time_t deadline) { _deadline.Store(deadline, MemoryOrder::RELAXED); }
+    time_t Deadline() const { return _deadline.Load(MemoryOrder::RELAXED); }
     void SetUserData(void* ptr);
     void GetUserData(void** ptr) const;
     void SetExtendInfo(uint64_t data);
@@ -55,23 +82,40 @@ public:
     int GetPeerString(char* buf, int buf_size);
 
 private:
-
+    // The slot owns one reference while the connection is online.
+    // TryRef fails once the count reached 0 and the object is
+    // waiting to be reused.
+    bool TryRef() { return _refs.IncrementIfNonzero(); }
+    // Return true if the last reference was dropped
+    bool Unref() { return _refs.FetchSub(1, MemoryOrder::ACQ_REL) == 1; }
+    // Close the fd and reset the state for the next connection,
+    // only when no reference is left
+    void Recycle();
+
+    // Return 1 if the recv was deferred, EPOLLIN is re-armed
+    // by ResumeRecv then
     int OnRecv();
-    int OnSend();
+    void ReleaseRecvBlock();
+    // writable is set if a blocked sender should be notified
+    int OnSend(bool* writable);
+    void CheckWritable(bool* writable);
 
     bool DoRecvEvent();
     bool DoSendEvent();
-    void ReleaseBuffer();
+    void ResumeRecv();
+    bool SendSlices(Slice&& hdr, Slice&& data);
+    int FlushSendBuffer();
+    void SetSendInterest(bool armed);
+
+    // recv and send are registered in the same epoll thread
+    bool IsSingleEventLoop() const { return _rcv_thd == _snd_thd; }
 
     // if success return the number of parsed packets
     // otherwise return -1 (protocol error)
     int  ParsingProtocol();
 
-    // return true if reach recv buffer tail.
-    bool ReadSliceFromRecvBuffer(size_t read_size, Slice& s);
-
     internal::INotificationTransfer* _service;
-    IProtocol* _proto;
+    PackageParser _parser;
     int _fd;
     ConnectionId _cid;
 
@@ -81,14 +125,31 @@ private:
     SliceBuffer _rcv_buffer;
     SliceBuffer _snd_buffer;
 
-    Mutex _rcv_mutex;
+    // _rcv_buffer and delivered packets reference this block,
+    // it is released when the last of them is gone
+    Slice _rcv_block;
+    size_t _rcv_block_used;
+
     Mutex _snd_mutex;
 
+    // 0 means unbounded
+    size_t _max_snd_size;
+    size_t _snd_low_watermark;
+    // a send was rejected since the last OnConnectionWritable
+    bool _snd_blocked;
+    // EPOLLOUT is registered, only while the kernel buffer is full
+    bool _snd_armed;
+
     raptor_resolved_address _addr;
     Slice _addr_str;
 
     uint64_t _user_data;
     void* _extend_ptr;
+    Atomic<time_t> _deadline;
+    time_t _idle_timeout;
+
+    AtomicInt32 _refs;
+    AtomicBool _online;
 };
 
 } // namespace raptor
@@ -22,6 +22,7 @@
 namespace raptor {
 SendRecvThread::SendRecvThread(internal::IEpollReceiver* rcv)
     : _receiver(rcv), _shutdown(true) {
+    _stop.Store(true);
 }
 
 SendRecvThread::~SendRecvThread() {}
@@ -32,6 +33,7 @@ RefCountedPtr<Status> SendRecvThread::Init() {
     }
 
     _shutdown = false;
+    _stop.Store(false);
     auto e = _epoll.create();
     if (e == RAPTOR_ERROR_NONE) {
         _thd = Thread("send/recv",
@@ -48,21 +50,26 @@ bool SendRecvThread::Start() {
     return false;
 }
 
+void SendRecvThread::Stop() {
+    _stop.Store(true, MemoryOrder::RELEASE);
+}
+
 void SendRecvThread::Shutdown() {
     if (!_shutdown) {
         _shutdown = true;
+        Stop();
         _thd.Join();
     }
 }
 
 void SendRecvThread::DoWork(void* ptr) {
-    while (!_shutdown) {
-        
+    while (!_stop.Load(MemoryOrder::ACQUIRE)) {
+
         time_t current_time = Now();
-        _receiver->OnCheckingEvent(current_time);
+        _receiver->OnCheckingEvent(this, current_time);
 
         int number_of_fd = _epoll.polling();
-        if (_shutdown) {
+        if (_stop.Load(MemoryOrder::ACQUIRE)) {
             return;
         }
         if (number_of_fd <= 0) {
@@ -89,7 +96,11 @@ void SendRecvThread::DoWork(void* ptr) {
 }
 
 int SendRecvThread::Add(int fd, void* data, uint32_t events) {
-    return _epoll.add(fd, data, events | EPOLLRDHUP);
+    int r = _epoll.add(fd, data, events | EPOLLRDHUP);
+    if (r == 0) {
+        _count.FetchAdd(1, MemoryOrder::RELAXED);
+    }
+    return r;
 }
 
 int SendRecvThread::Modify(int fd, void* data, uint32_t events) {
@@ -97,7 +108,15 @@ int SendRecvThread::Modify(int fd, void* data, uint32_t events) {
 }
 
 int SendRecvThread::Delete(int fd, uint32_t events) {
-    return _epoll.remove(fd, events | EPOLLRDHUP);
+    int r = _epoll.remove(fd, events | EPOLLRDHUP);
+    if (r == 0) {
+        _count.FetchSub(1, MemoryOrder::RELAXED);
+    }
+    return r;
+}
+
+uint32_t SendRecvThread::Count() const {
+    return _count.Load(MemoryOrder::RELAXED);
 }
 
 } // namespace raptor
@@ -22,6 +22,7 @@
 #include <stdint.h>
 #include "core/linux/epoll.h"
 #include "core/service.h"
+#include "util/atomic.h"
 #include "util/status.h"
 #include "util/thread.h"
 
@@ -33,18 +34,26 @@ public:
 
     RefCountedPtr<Status> Init();
     bool Start();
+    // Ask the thread to exit without waiting for it, so a number of
+    // threads can be stopped in parallel before Shutdown joins them
+    void Stop();
     void Shutdown();
 
     int Add(int fd, void* data, uint32_t events);
     int Modify(int fd, void* data, uint32_t events);
     int Delete(int fd, uint32_t events);
 
+    // number of fds currently registered
+    uint32_t Count() const;
+
 private:
     void DoWork(void* ptr);
     internal::IEpollReceiver* _receiver;
     bool _shutdown;
+    AtomicBool _stop;
     Epoll _epoll;
     Thread _thd;
+    AtomicUInt32 _count;
 };
 
 } // namespace raptor
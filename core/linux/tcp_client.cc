@@ -24,7 +24,6 @@
 namespace raptor {
 TcpClient::TcpClient(IClientReceiver* service)
     : _service(service)
-    , _proto(nullptr)
     , _shutdown(true)
     , _fd(-1) {
 }
@@ -77,7 +76,7 @@ bool TcpClient::IsOnline() const {
 }
 
 void TcpClient::SetProtocol(IProtocol* proto) {
-    _proto = proto;
+    _parser.SetProtocol(proto);
 }
 
 void TcpClient::Shutdown() {
@@ -95,6 +94,7 @@ void TcpClient::Shutdown() {
 
         _r_mtx.Lock();
         _rcv_buffer.ClearBuffer();
+        _parser.Reset();
         _r_mtx.Unlock();
     }
 }
@@ -226,60 +226,15 @@ raptor_error TcpClient::AsyncConnect(
     return RAPTOR_ERROR_NONE;
 }
 
-bool TcpClient::ReadSliceFromRecvBuffer(size_t read_size, Slice& s) {
-    size_t cache_size = _rcv_buffer.GetBufferLength();
-    if (read_size >= cache_size) {
-        s = _rcv_buffer.Merge();
-        return true;
-    }
-    s = _rcv_buffer.GetHeader(read_size);
-    return false;
-}
-
 int TcpClient::ParsingProtocol() {
-    size_t cache_size = _rcv_buffer.GetBufferLength();
-    size_t header_size = _proto->GetMaxHeaderSize();
     int package_counter = 0;
-
-    while (cache_size > 0) {
-        size_t read_size = header_size;
-        int pack_len = 0;
-        Slice package;
-        do {
-            bool reach_tail = ReadSliceFromRecvBuffer(read_size, package);
-            pack_len = _proto->CheckPackageLength(package.begin(), package.size());
-            if (pack_len < 0) {
-                log_error("tcp client: internal protocol error(pack_len = %d)", pack_len);
-                return -1;
-            }
-
-            // equal 0 means we need more data
-            if (pack_len == 0) {
-                if (reach_tail) {
-                    goto done;
-                }
-                read_size *= 2;
-                continue;
-            }
-
-            // We got the length of a whole packet
-            if (cache_size >= (size_t)pack_len) {
-                break;
-            }
-            goto done;
-        } while (false);
-
-        if (package.size() < static_cast<size_t>(pack_len)) {
-            package = _rcv_buffer.GetHeader(pack_len);
-        }
-        _service->OnMessageReceived(package.begin(), pack_len);
-        _rcv_buffer.MoveHeader(pack_len);
-
-        cache_size = _rcv_buffer.GetBufferLength();
+    Slice package;
+    int r = 0;
+    while ((r = _parser.Next(&_rcv_buffer, &package)) > 0) {
+        _service->OnMessageReceived(package.begin(), package.size());
         package_counter++;
     }
-done:
-    return package_counter;
+    return (r < 0) ? -1 : package_counter;
 }
 
 } // namespace raptor
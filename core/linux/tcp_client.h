@@ -19,6 +19,7 @@
 #ifndef __RAPTOR_CORE_LINUX_TCP_CLIENT__
 #define __RAPTOR_CORE_LINUX_TCP_CLIENT__
 
+#include "core/package_parser.h"
 #include "core/resolve_address.h"
 #include "core/sockaddr.h"
 #include "core/slice/slice.h"
@@ -55,12 +56,9 @@ private:
     // otherwise return -1 (protocol error)
     int  ParsingProtocol();
 
-    // return true if reach recv buffer tail.
-    bool ReadSliceFromRecvBuffer(size_t read_size, Slice& s);
-
 private:
     IClientReceiver *_service;
-    IProtocol* _proto;
+    PackageParser _parser;
 
     bool _shutdown;
     bool _is_connected;
@@ -17,11 +17,16 @@
  */
 
 #include "core/linux/tcp_server.h"
+#include <string.h>
+#include <sys/mman.h>
+#include <thread>
+#include <utility>
 #include "core/linux/tcp_listener.h"
 #include "core/linux/socket_setting.h"
 #include "core/mpscq.h"
 #include "core/resolve_address.h"
 #include "core/socket_util.h"
+#include "util/alloc.h"
 #include "util/log.h"
 #include "util/time.h"
 
@@ -30,72 +35,153 @@ enum MessageType {
     kNewConnection,
     kRecvAMessage,
     kCloseClient,
+    kWritable,
 };
-struct TcpMessageNode {
+struct TcpMessageNode : public AllocatedObject {
     MultiProducerSingleConsumerQueue::Node node;
     MessageType type;
     ConnectionId cid;
     Slice addr;
     Slice slice;
+    // position in TcpServer::_nodes, InvalidIndex if allocated from heap
+    uint32_t index;
 };
 constexpr uint32_t InvalidIndex = static_cast<uint32_t>(-1);
+constexpr size_t CACHE_LINE_SIZE = 64;
+constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
 TcpServer::TcpServer(IServerReceiver *service)
     : _service(service)
     , _proto(nullptr)
-    , _shutdown(true) {}
+    , _shutdown(true)
+    , _lookups(0)
+    , _mqs(nullptr)
+    , _mq_count(0)
+    , _high_watermark(0)
+    , _low_watermark(0)
+    , _nodes(nullptr)
+    , _wheels(nullptr)
+    , _slots(nullptr)
+    , _conn_region(nullptr)
+    , _conn_region_size(0)
+    , _slot_used(0) {}
 
 TcpServer::~TcpServer() {
-    if (!_shutdown) {
+    if (!_shutdown.Load()) {
         Shutdown();
     }
 }
 
 raptor_error TcpServer::Init(const RaptorOptions* options) {
-    if (!_shutdown) return RAPTOR_ERROR_FROM_STATIC_STRING("tcp server already running");
+    if (!_shutdown.Load()) return RAPTOR_ERROR_FROM_STATIC_STRING("tcp server already running");
 
-    _listener = std::make_shared<TcpListener>(this);
-    _recv_thread = std::make_shared<SendRecvThread>(this);
-    _send_thread = std::make_shared<SendRecvThread>(this);
+    size_t shards = options->send_recv_threads;
+    if (shards == 0) {
+        shards = DEFAULT_SEND_RECV_THREADS;
+    }
 
+    _listener = std::make_shared<TcpListener>(this);
     auto e = _listener->Init();
     if (e != RAPTOR_ERROR_NONE) {
         return e;
     }
 
-    e = _recv_thread->Init();
-    if (e != RAPTOR_ERROR_NONE) {
-        return e;
-    }
+    _recv_threads.clear();
+    _send_threads.clear();
+    for (size_t i = 0; i < shards; i++) {
+        auto rcv = std::make_shared<SendRecvThread>(this);
+        e = rcv->Init();
+        if (e != RAPTOR_ERROR_NONE) {
+            return e;
+        }
 
-    e = _send_thread->Init();
-    if (e != RAPTOR_ERROR_NONE) {
-        return e;
+        _recv_threads.push_back(rcv);
+
+        // In single event loop mode, the recv thread also does the sending
+        if (options->single_event_loop) {
+            continue;
+        }
+
+        auto snd = std::make_shared<SendRecvThread>(this);
+        e = snd->Init();
+        if (e != RAPTOR_ERROR_NONE) {
+            return e;
+        }
+        _send_threads.push_back(snd);
     }
 
-    _shutdown = false;
+    _shutdown.Store(false, MemoryOrder::SEQ_CST);
     _options = *options;
-    _count.Store(0);
+    if (_options.max_connections == 0) {
+        _options.max_connections = RESERVED_CONNECTION_COUNT;
+    }
+    if (_options.send_buffer_low_watermark == 0
+        || _options.send_buffer_low_watermark >= _options.max_send_buffer_size) {
+        _options.send_buffer_low_watermark = _options.max_send_buffer_size / 2;
+    }
 
-    _mq_thd = Thread(
+    _mq_count = options->dispatch_threads;
+    if (_mq_count == 0) {
+        _mq_count = DEFAULT_DISPATCH_THREADS;
+    }
+    size_t pool_size = options->message_pool_size;
+    if (pool_size == 0) {
+        pool_size = DEFAULT_MESSAGE_POOL_SIZE;
+    }
+    _nodes = new TcpMessageNode[pool_size];
+    _free_nodes.Init(static_cast<uint32_t>(pool_size));
+    for (size_t i = pool_size; i > 0; i--) {
+        _nodes[i - 1].index = static_cast<uint32_t>(i - 1);
+        _free_nodes.Push(static_cast<uint32_t>(i - 1));
+    }
+    _overflow_nodes.Store(0);
+
+    _high_watermark = options->message_queue_high_watermark;
+    _low_watermark = options->message_queue_low_watermark;
+    if (_low_watermark == 0 || _low_watermark >= _high_watermark) {
+        _low_watermark = _high_watermark / 2;
+    }
+
+    _mqs = new MessageQueue[_mq_count];
+    for (size_t i = 0; i < _mq_count; i++) {
+        _mqs[i].count.Store(0);
+        _mqs[i].sleeping.Store(false);
+        _mqs[i].paused.Store(false);
+        _mqs[i].thd = Thread(
             "message_queue",
             std::bind(&TcpServer::MessageQueueThread, this, std::placeholders::_1)
-            , nullptr);
-
-    _conn_mtx.Lock();
-    _mgr.resize(RESERVED_CONNECTION_COUNT);
-    for (size_t i = 0; i < RESERVED_CONNECTION_COUNT; i++) {
-        _free_index_list.push_back(i);
+            , &_mqs[i]);
     }
-    _conn_mtx.Unlock();
 
     time_t n = Now();
-    _magic_number = (n >> 16) & 0xffff;
-    _last_timeout_time.Store(n);
+    _wheels = new TimingWheel[shards];
+    for (size_t i = 0; i < shards; i++) {
+        _wheels[i].Init(n);
+    }
+
+    // Generations start from the time, ids of an earlier run are not
+    // taken for connections of this one
+    if (_options.max_connections > core::MaxConnectionSlots) {
+        _options.max_connections = core::MaxConnectionSlots;
+    }
+    uint32_t generation = static_cast<uint32_t>(n) & core::GenerationMask;
+    _slots = new ConnectionSlot[_options.max_connections];
+    for (size_t i = 0; i < _options.max_connections; i++) {
+        _slots[i].con.Store(nullptr);
+        _slots[i].generation.Store(generation);
+        _slots[i].deferred = core::InvalidConnectionId;
+    }
+    if (_options.preallocate_connections && !PreallocateConnections()) {
+        log_error("tcpserver: failed to preallocate %u connections, "
+            "they are allocated on demand", _options.max_connections);
+    }
+    _free_slots.Init(_options.max_connections);
+    _slot_used.Store(0, MemoryOrder::RELEASE);
+
     return RAPTOR_ERROR_NONE;
 }
 
 raptor_error TcpServer::AddListening(const char* addr) {
-    if (_shutdown) return RAPTOR_ERROR_FROM_STATIC_STRING("tcp server uninitialized");
+    if (_shutdown.Load()) return RAPTOR_ERROR_FROM_STATIC_STRING("tcp server uninitialized");
     if (!addr) return RAPTOR_ERROR_FROM_STATIC_STRING("invalid parameters");
     raptor_resolved_addresses* addrs;
     auto ret = raptor_blocking_resolve_address(addr, nullptr, &addrs);
@@ -121,47 +207,80 @@ raptor_error TcpServer::Start() {
     if (!_listener->StartListening()) {
         return RAPTOR_ERROR_FROM_STATIC_STRING("failed to start listener");
     }
-    if (!_recv_thread->Start()) {
-        return RAPTOR_ERROR_FROM_STATIC_STRING("failed to start recv thread");
+    for (auto& thd : _recv_threads) {
+        if (!thd->Start()) {
+            return RAPTOR_ERROR_FROM_STATIC_STRING("failed to start recv thread");
+        }
+    }
+    for (auto& thd : _send_threads) {
+        if (!thd->Start()) {
+            return RAPTOR_ERROR_FROM_STATIC_STRING("failed to start send thread");
+        }
     }
-    if (!_send_thread->Start()) {
-        return RAPTOR_ERROR_FROM_STATIC_STRING("failed to start send thread");
+    for (size_t i = 0; i < _mq_count; i++) {
+        _mqs[i].thd.Start();
     }
-    _mq_thd.Start();
     return RAPTOR_ERROR_NONE;
 }
 
 void TcpServer::Shutdown() {
-    if (!_shutdown) {
-        _shutdown = true;
+    if (!_shutdown.Load()) {
+        // New lookups fail from here on, the ones in progress
+        // finish before anything they may touch is freed
+        _shutdown.Store(true, MemoryOrder::SEQ_CST);
+        while (_lookups.Load(MemoryOrder::SEQ_CST) != 0) {
+            std::this_thread::yield();
+        }
+
+        // Every thread wakes up within one epoll timeout,
+        // stop them all before joining any
+        for (auto& thd : _recv_threads) {
+            thd->Stop();
+        }
+        for (auto& thd : _send_threads) {
+            thd->Stop();
+        }
         _listener->Shutdown();
-        _recv_thread->Shutdown();
-        _send_thread->Shutdown();
-        _cv.Signal();
-        _mq_thd.Join();
-
-        _conn_mtx.Lock();
-        _timeout_record_list.clear();
-        _free_index_list.clear();
-        for (auto& obj : _mgr) {
-            if (obj.first) {
-                obj.first->Shutdown(false);
-                obj.first.reset();
-            }
+        for (auto& thd : _recv_threads) {
+            thd->Shutdown();
+        }
+        for (auto& thd : _send_threads) {
+            thd->Shutdown();
         }
-        _mgr.clear();
-        _conn_mtx.Unlock();
+        for (size_t i = 0; i < _mq_count; i++) {
+            _mqs[i].mutex.Lock();
+            _mqs[i].cv.Signal();
+            _mqs[i].mutex.Unlock();
+            _mqs[i].thd.Join();
+        }
+
+        ReleaseConnections();
+        _free_slots.Destroy();
+        _slot_used.Store(0);
+        delete[] _slots;
+        _slots = nullptr;
+        delete[] _wheels;
+        _wheels = nullptr;
 
         // clear message queue
-        bool empty = true;
-        do {
-            auto n = _mpscq.PopAndCheckEnd(&empty);
-            auto msg = reinterpret_cast<TcpMessageNode*>(n);
-            if (msg != nullptr) {
-                _count.FetchSub(1, MemoryOrder::RELAXED);
-                delete msg;
-            }
-        } while (!empty);
+        for (size_t i = 0; i < _mq_count; i++) {
+            bool empty = true;
+            do {
+                auto n = _mqs[i].mpscq.PopAndCheckEnd(&empty);
+                auto msg = reinterpret_cast<TcpMessageNode*>(n);
+                if (msg != nullptr) {
+                    _mqs[i].count.FetchSub(1, MemoryOrder::RELAXED);
+                    FreeMessage(msg);
+                }
+            } while (!empty);
+        }
+        delete[] _mqs;
+        _mqs = nullptr;
+        _mq_count = 0;
+
+        _free_nodes.Destroy();
+        delete[] _nodes;
+        _nodes = nullptr;
     }
 }
 
@@ -175,246 +294,418 @@ bool TcpServer::Send(ConnectionId cid, const void* buf, size_t len) {
 
 bool TcpServer::SendWithHeader(ConnectionId cid,
         const void* hdr, size_t hdr_len, const void* data, size_t data_len) {
-    uint32_t index = CheckConnectionId(cid);
-    if (index == InvalidIndex) {
-        return false;
+    auto con = GetConnection(cid);
+    if (con) {
+        return con->SendWithHeader(hdr, hdr_len, data, data_len);
     }
+    return false;
+}
 
-    auto con = GetConnection(index);
+bool TcpServer::SendSlice(ConnectionId cid, const Slice& s) {
+    auto con = GetConnection(cid);
     if (con) {
-        return con->SendWithHeader(hdr, hdr_len, data, data_len);
+        return con->SendSlice(s);
     }
     return false;
 }
 
-bool TcpServer::CloseConnection(ConnectionId cid){
-    uint32_t index = CheckConnectionId(cid);
-    if (index == InvalidIndex) {
-        return false;
+// Every send queue references the same slice instead of
+// a copy of the payload, the lookups take no lock.
+size_t TcpServer::Broadcast(const ConnectionId* cids, size_t count, const Slice& s) {
+    size_t sent = 0;
+    for (size_t i = 0; i < count; i++) {
+        auto con = GetConnection(cids[i]);
+        if (con && con->SendSlice(s)) {
+            sent++;
+        }
     }
+    return sent;
+}
 
-    auto con = GetConnection(index);
-    if (con) {
-        con->Shutdown(false);
-        DeleteConnection(index);
+size_t TcpServer::BroadcastAll(const Slice& s) {
+    if (!EnterLookup()) {
+        return 0;
     }
+    uint32_t used = _slot_used.Load(MemoryOrder::ACQUIRE);
+
+    size_t sent = 0;
+    for (uint32_t i = 0; i < used; i++) {
+        Connection* con = _slots[i].con.Load(MemoryOrder::ACQUIRE);
+        if (!con || !con->TryRef()) {
+            continue;
+        }
+        if (con->SendSlice(s)) {
+            sent++;
+        }
+        ReleaseConnection(con);
+    }
+    LeaveLookup();
+    return sent;
+}
+
+bool TcpServer::CloseConnection(ConnectionId cid){
+    auto con = GetConnection(cid);
+    if (!con) {
+        return false;
+    }
+    ShutdownConnection(con.get(), false);
     return true;
 }
 
 // IAcceptor implement
 void TcpServer::OnNewConnection(int sock,
     int listen_port, const raptor_resolved_address* addr) {
-    AutoMutex g(&_conn_mtx);
-
-    if (_free_index_list.empty() && _mgr.size() >= _options.max_connections) {
+    uint32_t index = AcquireSlot();
+    if (index == InvalidIndex) {
         log_error("The maximum number of connections has been reached: %u", _options.max_connections);
         raptor_set_socket_shutdown(sock);
         return;
     }
 
-    if (_free_index_list.empty()) {
-        size_t count = _mgr.size();
-        size_t expand = ((count * 2) < _options.max_connections) ? (count * 2) : _options.max_connections;
-        _mgr.resize(expand);
-        for (size_t i = count; i < expand; i++) {
-            _mgr[i].first = nullptr;
-            _mgr[i].second = _timeout_record_list.end();
-            _free_index_list.push_back(i);
-        }
-    }
-
-    uint32_t index = _free_index_list.front();
-    _free_index_list.pop_front();
-
-    ConnectionId cid = core::BuildConnectionId(_magic_number, listen_port, index);
+    // The old id is rejected by CheckConnectionId from here on
+    uint32_t generation =
+        (_slots[index].generation.Load() + 1) & core::GenerationMask;
+    _slots[index].generation.Store(generation, MemoryOrder::RELEASE);
+    ConnectionId cid = core::BuildConnectionId(
+        static_cast<uint16_t>(listen_port), generation, index);
     time_t deadline_seconds = Now() + _options.connection_timeout;
 
-    _mgr[index].first = std::make_shared<Connection>(this);
-    _mgr[index].first->SetProtocol(_proto);
-    _mgr[index].first->Init(cid, sock, addr, _recv_thread.get(), _send_thread.get());
-    _mgr[index].second = _timeout_record_list.insert({deadline_seconds, index});
+    // Nobody references a free slot's object, lookups fail on
+    // it until Init publishes the new connection.
+    Connection* con = _slots[index].con.Load(MemoryOrder::RELAXED);
+    if (!con) {
+        con = new Connection(this);
+        _slots[index].con.Store(con, MemoryOrder::RELEASE);
+    }
+    con->SetProtocol(_proto);
+    con->SetSendBufferLimit(_options.max_send_buffer_size, _options.send_buffer_low_watermark);
+    con->SetIdleTimeout(_options.connection_timeout);
+    con->SetDeadline(deadline_seconds);
+
+    // Init notifies OnConnected, which may run inline and call back
+    // into TcpServer.
+    size_t shard = SelectSendRecvThread();
+    _wheels[shard].Add(cid, deadline_seconds);
+    SendRecvThread* rcv = _recv_threads[shard].get();
+    SendRecvThread* snd = _send_threads.empty() ? rcv : _send_threads[shard].get();
+    con->Init(cid, sock, addr, rcv, snd);
+    ReleaseConnection(con);
 }
 
 // Receiver implement (epoll event)
 void TcpServer::OnErrorEvent(void* ptr) {
     ConnectionId cid = (ConnectionId)ptr;
-    uint32_t index = CheckConnectionId(cid);
-    if (index == InvalidIndex) {
-        log_error("tcpserver: OnErrorEvent found invalid index, cid = %x", cid);
-        return;
-    }
-
-    auto con = GetConnection(index);
+    auto con = GetConnection(cid);
     if (con) {
-        con->Shutdown(true);
-        DeleteConnection(index);
+        ShutdownConnection(con.get(), true);
     }
 }
 
 void TcpServer::OnRecvEvent(void* ptr) {
     ConnectionId cid = (ConnectionId)ptr;
-    uint32_t index = CheckConnectionId(cid);
-    if (index == InvalidIndex) {
-        log_error("tcpserver: OnRecvEvent found invalid index, cid = %x", cid);
+    auto con = GetConnection(cid);
+    if (!con) return;
+    if (DeferRecv(cid)) {
+        RefreshTime(con.get());
         return;
     }
-
-    auto con = GetConnection(index);
-    if (!con) return;
     if (con->DoRecvEvent()) {
-        RefreshTime(index);
+        RefreshTime(con.get());
         return;
     }
-    con->Shutdown(true);
-    DeleteConnection(index);
-    log_error("tcpserver: Failed to post async recv");
+    ShutdownConnection(con.get(), true);
 }
 
 void TcpServer::OnSendEvent(void* ptr) {
     ConnectionId cid = (ConnectionId)ptr;
-    uint32_t index = CheckConnectionId(cid);
-    if (index == InvalidIndex) {
-        log_error("tcpserver: OnRecvEvent found invalid index, cid = %x", cid);
-        return;
-    }
-
-    auto con = GetConnection(index);
+    auto con = GetConnection(cid);
     if (!con) return;
     if (con->DoSendEvent()) {
-        RefreshTime(index);
+        RefreshTime(con.get());
         return;
     }
-    con->Shutdown(true);
-    DeleteConnection(index);
-    log_error("tcpserver: Failed to post async send");
+    ShutdownConnection(con.get(), true);
 }
 
-void TcpServer::OnCheckingEvent(time_t current) {
-
-    // At least 3s to check once
-    if (current - _last_timeout_time.Load() < 3) {
+// Each recv thread sweeps the wheel of its own shard
+void TcpServer::OnCheckingEvent(SendRecvThread* thd, time_t current) {
+    size_t shard = 0;
+    while (shard < _recv_threads.size() && _recv_threads[shard].get() != thd) {
+        shard++;
+    }
+    if (shard == _recv_threads.size()) {
         return;
     }
-    _last_timeout_time.Store(current);
 
-    AutoMutex g(&_conn_mtx);
+    std::vector<ConnectionId> due;
+    if (!_wheels[shard].Expire(current, &due) || due.empty()) {
+        return;
+    }
 
-    auto it = _timeout_record_list.begin();
-    while (it != _timeout_record_list.end()) {
-        if (it->first > current) {
-            break;
+    for (ConnectionId cid : due) {
+        auto con = GetConnection(cid);
+        if (!con) {
+            continue;
         }
-
-        uint32_t index = it->second;
-
-        ++it;
-
-        _mgr[index].first->Shutdown(true);
-        _mgr[index].first.reset();
-        _timeout_record_list.erase(_mgr[index].second);
-        _mgr[index].second = _timeout_record_list.end();
-        _free_index_list.push_back(index);
+        time_t deadline = con->Deadline();
+        if (deadline > current) {
+            _wheels[shard].Add(cid, deadline);
+            continue;
+        }
+        ShutdownConnection(con.get(), true);
     }
 }
 
 // ServiceInterface implement
 void TcpServer::OnConnectionArrived(ConnectionId cid, const Slice* addr) {
-    TcpMessageNode* msg = new TcpMessageNode;
+    if (_options.inline_dispatch) {
+        _service->OnConnected(cid, reinterpret_cast<const char*>(addr->begin()));
+        return;
+    }
+    TcpMessageNode* msg = AllocMessage();
     msg->cid = cid;
     msg->addr = *addr;
     msg->type = MessageType::kNewConnection;
-    _mpscq.push(&msg->node);
-    _count.FetchAdd(1, MemoryOrder::ACQ_REL);
-    _cv.Signal();
+    PushMessage(msg);
 }
 
-void TcpServer::OnDataReceived(ConnectionId cid, const Slice* s) {
-    TcpMessageNode* msg = new TcpMessageNode;
+void TcpServer::OnDataReceived(ConnectionId cid, Slice&& s) {
+    if (_options.inline_dispatch) {
+        // Through the batch entry, a batch callback replaces
+        // the per-message one
+        raptor_message_t m;
+        m.cid = cid;
+        m.data = s.begin();
+        m.length = s.size();
+        _service->OnMessagesReceived(&m, 1);
+        return;
+    }
+    TcpMessageNode* msg = AllocMessage();
     msg->cid = cid;
-    msg->slice = *s;
+    msg->slice = std::move(s);
     msg->type = MessageType::kRecvAMessage;
-    _mpscq.push(&msg->node);
-    _count.FetchAdd(1, MemoryOrder::ACQ_REL);
-    _cv.Signal();
+    PushMessage(msg);
 }
 
 void TcpServer::OnConnectionClosed(ConnectionId cid) {
-    TcpMessageNode* msg = new TcpMessageNode;
+    if (_options.inline_dispatch) {
+        _service->OnClosed(cid);
+        return;
+    }
+    TcpMessageNode* msg = AllocMessage();
     msg->cid = cid;
     msg->type = MessageType::kCloseClient;
-    _mpscq.push(&msg->node);
-    _count.FetchAdd(1, MemoryOrder::ACQ_REL);
-    _cv.Signal();
+    PushMessage(msg);
+}
+
+void TcpServer::OnConnectionWritable(ConnectionId cid) {
+    if (_options.inline_dispatch) {
+        _service->OnWritable(cid);
+        return;
+    }
+    TcpMessageNode* msg = AllocMessage();
+    msg->cid = cid;
+    msg->type = MessageType::kWritable;
+    PushMessage(msg);
+}
+
+TcpMessageNode* TcpServer::AllocMessage() {
+    uint32_t index = _free_nodes.Pop();
+    if (index != IndexStack::InvalidIndex) {
+        return &_nodes[index];
+    }
+    _overflow_nodes.FetchAdd(1, MemoryOrder::RELAXED);
+    TcpMessageNode* msg = new TcpMessageNode;
+    msg->index = InvalidIndex;
+    return msg;
+}
+
+void TcpServer::FreeMessage(TcpMessageNode* msg) {
+    if (msg->index == InvalidIndex) {
+        delete msg;
+        return;
+    }
+    // drop the payload references before recycling
+    msg->addr = Slice();
+    msg->slice = Slice();
+    _free_nodes.Push(msg->index);
+}
+
+// Messages of a connection always go to the same queue,
+// so they are delivered in order.
+void TcpServer::PushMessage(struct TcpMessageNode* msg) {
+    MessageQueue* mq = &_mqs[core::GetUserId(msg->cid) % _mq_count];
+    // Counted before it is pushed, the consumer's FetchSub of the
+    // nodes it popped never takes count below 0
+    uint32_t count = mq->count.FetchAdd(1, MemoryOrder::SEQ_CST) + 1;
+    mq->mpscq.push(&msg->node);
+
+    if (_high_watermark > 0 && count >= _high_watermark
+        && !mq->paused.Load(MemoryOrder::RELAXED)) {
+        mq->paused.Store(true, MemoryOrder::SEQ_CST);
+    }
+
+    // Pairs with the sleeping store in MessageQueueThread,
+    // the consumer is woken up only when it is parked.
+    // The paused store above is ordered the same way, a consumer
+    // that drained the queue before it still sees it.
+    if (mq->sleeping.Load(MemoryOrder::SEQ_CST)) {
+        AutoMutex g(&mq->mutex);
+        mq->cv.Signal();
+    }
+}
+
+// Return the number of messages dispatched
+size_t TcpServer::ConsumeMessages(MessageQueue* mq) {
+    // Consecutive packages are delivered in one OnMessagesReceived,
+    // their nodes hold the data until the call returns.
+    raptor_message_t msgs[MESSAGE_BATCH_SIZE];
+    TcpMessageNode* nodes[MESSAGE_BATCH_SIZE];
+    size_t count = 0;
+
+    size_t n = 0;
+    while (n < MESSAGE_BATCH_SIZE) {
+        auto node = mq->mpscq.pop();
+        if (node == nullptr) {
+            break;
+        }
+        auto msg = reinterpret_cast<struct TcpMessageNode*>(node);
+        n++;
+        if (msg->type == MessageType::kRecvAMessage) {
+            msgs[count].cid = msg->cid;
+            msgs[count].data = msg->slice.begin();
+            msgs[count].length = msg->slice.size();
+            nodes[count++] = msg;
+            continue;
+        }
+        DispatchMessages(msgs, nodes, count);
+        count = 0;
+        this->Dispatch(msg);
+        FreeMessage(msg);
+    }
+    DispatchMessages(msgs, nodes, count);
+    if (n > 0) {
+        mq->count.FetchSub(static_cast<uint32_t>(n), MemoryOrder::RELAXED);
+    }
+    return n;
+}
+
+// Return true if the queue of cid is above the high watermark,
+// the recv is skipped and retried by ResumeRecv. A slot is listed
+// once however often its recv is deferred, an older id left in
+// it by a closed connection is replaced.
+bool TcpServer::DeferRecv(ConnectionId cid) {
+    if (_high_watermark == 0 || _options.inline_dispatch) {
+        return false;
+    }
+    MessageQueue* mq = &_mqs[core::GetUserId(cid) % _mq_count];
+    if (!mq->paused.Load(MemoryOrder::RELAXED)) {
+        return false;
+    }
+
+    AutoMutex g(&mq->deferred_mtx);
+    if (!mq->paused.Load(MemoryOrder::RELAXED)) {
+        return false;
+    }
+    ConnectionSlot* slot = &_slots[core::GetUserId(cid)];
+    if (slot->deferred == core::InvalidConnectionId) {
+        mq->deferred.push_back(cid);
+    }
+    slot->deferred = cid;
+    return true;
+}
+
+void TcpServer::ResumeRecv(MessageQueue* mq) {
+    std::vector<ConnectionId> deferred;
+    {
+        AutoMutex g(&mq->deferred_mtx);
+        mq->paused.Store(false, MemoryOrder::RELAXED);
+        deferred.swap(mq->deferred);
+        for (auto& cid : deferred) {
+            ConnectionSlot* slot = &_slots[core::GetUserId(cid)];
+            cid = slot->deferred;
+            slot->deferred = core::InvalidConnectionId;
+        }
+    }
+
+    for (auto cid : deferred) {
+        auto con = GetConnection(cid);
+        if (con) {
+            con->ResumeRecv();
+        }
+    }
 }
 
 void TcpServer::MessageQueueThread(void* ptr) {
-    while (!_shutdown) {
-        RaptorMutexLock(_mutex);
-
-        while (_count.Load() == 0) {
-            _cv.Wait(&_mutex);
-            if (_shutdown) {
-                RaptorMutexUnlock(_mutex);
-                return;
-            }
+    MessageQueue* mq = reinterpret_cast<MessageQueue*>(ptr);
+    int spin = 0;
+    while (!_shutdown.Load()) {
+        size_t n = ConsumeMessages(mq);
+        if (mq->paused.Load(MemoryOrder::RELAXED)
+            && mq->count.Load() <= _low_watermark) {
+            ResumeRecv(mq);
+        }
+        if (n > 0) {
+            spin = 0;
+            continue;
         }
-        auto n = _mpscq.pop();
-        auto msg = reinterpret_cast<struct TcpMessageNode*>(n);
 
-        if (msg != nullptr) {
-            _count.FetchSub(1, MemoryOrder::RELAXED);
-            this->Dispatch(msg);
-            delete msg;
+        // Spin for a while before parking, a busy queue
+        // never goes through the mutex and condvar.
+        if (spin++ < MESSAGE_SPIN_COUNT) {
+            continue;
+        }
+        spin = 0;
+
+        RaptorMutexLock(mq->mutex);
+        mq->sleeping.Store(true, MemoryOrder::SEQ_CST);
+        // A queue paused with nothing left in it would never
+        // be resumed, go back and call ResumeRecv instead.
+        while (mq->count.Load(MemoryOrder::SEQ_CST) == 0
+            && !mq->paused.Load(MemoryOrder::SEQ_CST) && !_shutdown.Load()) {
+            mq->cv.Wait(&mq->mutex);
         }
-        RaptorMutexUnlock(_mutex);
+        mq->sleeping.Store(false, MemoryOrder::RELAXED);
+        RaptorMutexUnlock(mq->mutex);
+    }
+}
+
+void TcpServer::DispatchMessages(
+    const raptor_message_t* msgs, struct TcpMessageNode** nodes, size_t count) {
+    if (count == 0) {
+        return;
+    }
+    _service->OnMessagesReceived(msgs, count);
+    for (size_t i = 0; i < count; i++) {
+        FreeMessage(nodes[i]);
     }
 }
 
+// Packages never get here, ConsumeMessages batches them
 void TcpServer::Dispatch(struct TcpMessageNode* msg) {
     switch (msg->type) {
     case MessageType::kNewConnection:
         _service->OnConnected(msg->cid, reinterpret_cast<const char*>(msg->addr.begin()));
         break;
-    case MessageType::kRecvAMessage:
-        _service->OnMessageReceived(msg->cid, msg->slice.begin(), msg->slice.size());
-        break;
     case MessageType::kCloseClient:
         _service->OnClosed(msg->cid);
         break;
+    case MessageType::kWritable:
+        _service->OnWritable(msg->cid);
+        break;
     default:
         log_error("unknow message type %d", static_cast<int>(msg->type));
         break;
     }
 }
 
-void TcpServer::DeleteConnection(uint32_t index) {
-    AutoMutex g(&_conn_mtx);
-    if (!_mgr[index].first) {
-        return;
-    }
-    _mgr[index].first.reset();
-    _timeout_record_list.erase(_mgr[index].second);
-    _mgr[index].second = _timeout_record_list.end();
-    _free_index_list.push_back(index);
-}
-
-void TcpServer::RefreshTime(uint32_t index) {
-    AutoMutex g(&_conn_mtx);
-    if (!_mgr[index].first) {
-        return;
-    }
-    time_t deadline_seconds = Now() + _options.connection_timeout;
-    _timeout_record_list.erase(_mgr[index].second);
-    _mgr[index].second = _timeout_record_list.insert({deadline_seconds, index});
+// A plain store, the wheel picks the new deadline up lazily
+void TcpServer::RefreshTime(Connection* con) {
+    con->SetDeadline(Now() + _options.connection_timeout);
 }
 
 bool TcpServer::SetUserData(ConnectionId cid, void* ptr) {
-    uint32_t index = CheckConnectionId(cid);
-    if (index == InvalidIndex) {
-        return false;
-    }
-
-    auto con = GetConnection(index);
+    auto con = GetConnection(cid);
     if (con) {
         con->SetUserData(ptr);
         return true;
@@ -423,12 +714,7 @@ bool TcpServer::SetUserData(ConnectionId cid, void* ptr) {
 }
 
 bool TcpServer::GetUserData(ConnectionId cid, void** ptr) {
-    uint32_t index = CheckConnectionId(cid);
-    if (index == InvalidIndex) {
-        return false;
-    }
-
-    auto con = GetConnection(index);
+    auto con = GetConnection(cid);
     if (con) {
         con->GetUserData(ptr);
         return true;
@@ -437,12 +723,7 @@ bool TcpServer::GetUserData(ConnectionId cid, void** ptr) {
 }
 
 bool TcpServer::SetExtendInfo(ConnectionId cid, uint64_t data) {
-    uint32_t index = CheckConnectionId(cid);
-    if (index == InvalidIndex) {
-        return false;
-    }
-
-    auto con = GetConnection(index);
+    auto con = GetConnection(cid);
     if (con) {
         con->SetExtendInfo(data);
         return true;
@@ -451,12 +732,7 @@ bool TcpServer::SetExtendInfo(ConnectionId cid, uint64_t data) {
 }
 
 bool TcpServer::GetExtendInfo(ConnectionId cid, uint64_t& data) {
-    uint32_t index = CheckConnectionId(cid);
-    if (index == InvalidIndex) {
-        return false;
-    }
-
-    auto con = GetConnection(index);
+    auto con = GetConnection(cid);
     if (con) {
         con->GetExtendInfo(data);
         return true;
@@ -465,39 +741,191 @@ bool TcpServer::GetExtendInfo(ConnectionId cid, uint64_t& data) {
 }
 
 int TcpServer::GetPeerString(ConnectionId cid, char* buf, int buf_len) {
-    uint32_t index = CheckConnectionId(cid);
-    if (index == InvalidIndex) {
-        return -1;
-    }
-
-    auto con = GetConnection(index);
+    auto con = GetConnection(cid);
     if (con) {
         return con->GetPeerString(buf, buf_len);
     }
     return -1;
 }
 
+// A cid of an earlier occupant of the slot has an older generation.
+// Only called between EnterLookup and LeaveLookup.
 uint32_t TcpServer::CheckConnectionId(ConnectionId cid) const {
     uint32_t failure = InvalidIndex;
     if (cid == core::InvalidConnectionId) {
         return failure;
     }
-    uint16_t magic = core::GetMagicNumber(cid);
-    if (magic != _magic_number) {
-        return failure;
-    }
 
     uint32_t uid = core::GetUserId(cid);
     if (uid >= _options.max_connections) {
         return failure;
     }
+    if (core::GetGeneration(cid) != _slots[uid].generation.Load(MemoryOrder::ACQUIRE)) {
+        return failure;
+    }
     return uid;
 }
 
-std::shared_ptr<Connection> TcpServer::GetConnection(uint32_t index) {
-    AutoMutex g(&_conn_mtx);
-    auto obj = _mgr[index].first;
-    return obj;
+// Construct a Connection for every slot up front, a connection storm
+// then only reinitializes objects in place. Each object starts on a
+// cache line of its own. Explicit huge pages are tried first, then
+// transparent huge pages are requested for a normal mapping.
+bool TcpServer::PreallocateConnections() {
+    size_t count = _options.max_connections;
+    size_t stride = (sizeof(Connection) + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1);
+    size_t size = stride * count;
+    if (count == 0) {
+        return false;
+    }
+
+    void* region = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    size_t huge_size = (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    region = mmap(nullptr, huge_size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (region != MAP_FAILED) {
+        size = huge_size;
+    }
+#endif
+    if (region == MAP_FAILED) {
+        region = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (region == MAP_FAILED) {
+            return false;
+        }
+#ifdef MADV_HUGEPAGE
+        madvise(region, size, MADV_HUGEPAGE);
+#endif
+    }
+
+    _conn_region = static_cast<uint8_t*>(region);
+    _conn_region_size = size;
+    for (size_t i = 0; i < count; i++) {
+        Connection* con = new (_conn_region + i * stride) Connection(this);
+        _slots[i].con.Store(con, MemoryOrder::RELAXED);
+    }
+    return true;
+}
+
+// Only after the worker threads have stopped
+void TcpServer::ReleaseConnections() {
+    size_t count = _conn_region ? _options.max_connections : _slot_used.Load();
+    for (size_t i = 0; i < count; i++) {
+        Connection* con = _slots[i].con.Load();
+        if (!con) {
+            continue;
+        }
+        con->Shutdown(false);
+        con->Recycle();
+        if (_conn_region) {
+            con->~Connection();
+        } else {
+            delete con;
+        }
+    }
+    if (_conn_region) {
+        munmap(_conn_region, _conn_region_size);
+        _conn_region = nullptr;
+        _conn_region_size = 0;
+    }
+}
+
+// No lock is taken. The slot may hold the object of an older or a
+// newer connection, so the id is checked after the reference is taken.
+TcpServer::ConnectionRef TcpServer::GetConnection(ConnectionId cid) {
+    if (!EnterLookup()) {
+        return ConnectionRef(this, nullptr);
+    }
+    uint32_t index = CheckConnectionId(cid);
+    if (index == InvalidIndex) {
+        LeaveLookup();
+        return ConnectionRef(this, nullptr);
+    }
+    Connection* con = _slots[index].con.Load(MemoryOrder::ACQUIRE);
+    if (!con || !con->TryRef()) {
+        LeaveLookup();
+        return ConnectionRef(this, nullptr);
+    }
+    if (con->Id() != cid) {
+        ReleaseConnection(con);
+        LeaveLookup();
+        return ConnectionRef(this, nullptr);
+    }
+    // LeaveLookup is called when the reference is released
+    return ConnectionRef(this, con);
+}
+
+// Fails once Shutdown has started. Counted before _shutdown is read,
+// so Shutdown either sees the lookup or the lookup sees _shutdown.
+bool TcpServer::EnterLookup() {
+    _lookups.FetchAdd(1, MemoryOrder::SEQ_CST);
+    if (_shutdown.Load(MemoryOrder::SEQ_CST)) {
+        LeaveLookup();
+        return false;
+    }
+    return true;
+}
+
+void TcpServer::LeaveLookup() {
+    _lookups.FetchSub(1, MemoryOrder::RELEASE);
+}
+
+// The last reference recycles the object and frees its slot
+void TcpServer::ReleaseConnection(Connection* con) {
+    if (!con->Unref()) {
+        return;
+    }
+    uint32_t index = core::GetUserId(con->Id());
+    con->Recycle();
+    _free_slots.Push(index);
+}
+
+// A recently freed slot first, its object is likely still cached,
+// then one that has never been used.
+uint32_t TcpServer::AcquireSlot() {
+    uint32_t index = _free_slots.Pop();
+    if (index != IndexStack::InvalidIndex) {
+        return index;
+    }
+    uint32_t used = _slot_used.Load(MemoryOrder::ACQUIRE);
+    do {
+        if (used >= _options.max_connections) {
+            return InvalidIndex;
+        }
+    } while (!_slot_used.CompareExchangeWeak(
+        &used, used + 1, MemoryOrder::ACQ_REL, MemoryOrder::ACQUIRE));
+    return used;
+}
+
+// Only the caller that shuts the connection down
+// drops the reference owned by its slot
+void TcpServer::ShutdownConnection(Connection* con, bool notify) {
+    if (con->Shutdown(notify)) {
+        ReleaseConnection(con);
+    }
+}
+
+void TcpServer::GetStats(RaptorServerStats* stats) {
+    memset(stats, 0, sizeof(*stats));
+    size_t capacity = _free_nodes.Capacity();
+    size_t free_count = _free_nodes.Size();
+    stats->message_pool_capacity = capacity;
+    stats->message_pool_in_use = (capacity > free_count) ? (capacity - free_count) : 0;
+    stats->message_pool_overflow = static_cast<size_t>(_overflow_nodes.Load());
+}
+
+// Pick the least loaded shard for a new connection
+size_t TcpServer::SelectSendRecvThread() const {
+    size_t shard = 0;
+    uint32_t min_count = _recv_threads[0]->Count();
+    for (size_t i = 1; i < _recv_threads.size(); i++) {
+        uint32_t count = _recv_threads[i]->Count();
+        if (count < min_count) {
+            min_count = count;
+            shard = i;
+        }
+    }
+    return shard;
 }
 
 }  // namespace raptor
@@ -20,15 +20,15 @@
 #define __RAPTOR_CORE_LINUX_TCP_SERVER__
 
 #include <time.h>
-#include <map>
 #include <memory>
-#include <list>
 #include <utility>
 #include <vector>
 
 #include "core/linux/epoll_thread.h"
 #include "core/linux/connection.h"
+#include "core/index_stack.h"
 #include "core/mpscq.h"
+#include "core/timing_wheel.h"
 #include "util/status.h"
 #include "util/sync.h"
 #include "raptor/protocol.h"
@@ -55,6 +55,9 @@ public:
     bool Send(ConnectionId cid, const void* buf, size_t len);
     bool SendWithHeader(ConnectionId cid,
         const void* hdr, size_t hdr_len, const void* data, size_t data_len);
+    bool SendSlice(ConnectionId cid, const Slice& s);
+    size_t Broadcast(const ConnectionId* cids, size_t count, const Slice& s);
+    size_t BroadcastAll(const Slice& s);
     bool CloseConnection(ConnectionId cid);
 
     // internal::IAcceptor impl
@@ -66,12 +69,14 @@ public:
     void OnErrorEvent(void* ptr) override;
     void OnRecvEvent(void* ptr) override;
     void OnSendEvent(void* ptr) override;
-    void OnCheckingEvent(time_t current) override;
+    void OnCheckingEvent(SendRecvThread* thd, time_t current) override;
 
     // internal::INotificationTransfer impl
     void OnConnectionArrived(ConnectionId cid, const Slice* addr);
-    void OnDataReceived(ConnectionId cid, const Slice* s) override;
+    void OnDataReceived(ConnectionId cid, Slice&& s) override;
     void OnConnectionClosed(ConnectionId cid) override;
+    void OnConnectionWritable(ConnectionId cid) override;
+    bool DeferRecv(ConnectionId cid) override;
 
     // user data
     bool SetUserData(ConnectionId cid, void* ptr);
@@ -79,46 +84,136 @@ public:
     bool SetExtendInfo(ConnectionId cid, uint64_t data);
     bool GetExtendInfo(ConnectionId cid, uint64_t& data);
     int GetPeerString(ConnectionId cid, char* buf, int buf_len);
+    void GetStats(RaptorServerStats* stats);
 
 private:
+    struct MessageQueue;
+
+    // Holds a reference of a connection, its object is not
+    // reused for another connection while the reference lives.
+    class ConnectionRef final {
+    public:
+        ConnectionRef(TcpServer* server, Connection* con)
+            : _server(server), _con(con) {}
+        ConnectionRef(ConnectionRef&& other)
+            : _server(other._server), _con(other._con) {
+            other._con = nullptr;
+        }
+        ~ConnectionRef() {
+            if (_con) {
+                _server->ReleaseConnection(_con);
+                _server->LeaveLookup();
+            }
+        }
+
+        ConnectionRef(const ConnectionRef&) = delete;
+        ConnectionRef& operator= (const ConnectionRef&) = delete;
+
+        Connection* operator->() const { return _con; }
+        Connection* get() const { return _con; }
+        explicit operator bool() const { return _con != nullptr; }
+
+    private:
+        TcpServer* _server;
+        Connection* _con;
+    };
+
     void TimeoutCheckThread(void*);
     void MessageQueueThread(void*);
+    struct TcpMessageNode* AllocMessage();
+    void FreeMessage(struct TcpMessageNode* msg);
+    void PushMessage(struct TcpMessageNode* msg);
+    size_t ConsumeMessages(MessageQueue* mq);
+    void DispatchMessages(
+        const raptor_message_t* msgs, struct TcpMessageNode** nodes, size_t count);
+    void ResumeRecv(MessageQueue* mq);
     uint32_t CheckConnectionId(ConnectionId cid) const;
     void Dispatch(struct TcpMessageNode* msg);
-    void DeleteConnection(uint32_t index);
-    void RefreshTime(uint32_t index);
-    std::shared_ptr<Connection> GetConnection(uint32_t index);
+    void RefreshTime(Connection* con);
+    ConnectionRef GetConnection(ConnectionId cid);
+    bool EnterLookup();
+    void LeaveLookup();
+    uint32_t AcquireSlot();
+    void ReleaseConnection(Connection* con);
+    void ShutdownConnection(Connection* con, bool notify);
+    bool PreallocateConnections();
+    void ReleaseConnections();
+    size_t SelectSendRecvThread() const;
 
 private:
-    using TimeoutRecord = std::multimap<time_t, uint32_t>;
-    using ConnectionData =
-        std::pair<std::shared_ptr<Connection>, TimeoutRecord::iterator>;
-
     enum { RESERVED_CONNECTION_COUNT = 100 };
+    enum { DEFAULT_SEND_RECV_THREADS = 1 };
+    enum { DEFAULT_DISPATCH_THREADS = 1 };
+    enum { MESSAGE_BATCH_SIZE = 256 };
+    enum { MESSAGE_SPIN_COUNT = 2000 };
+    enum { DEFAULT_MESSAGE_POOL_SIZE = 4096 };
 
     IServerReceiver* _service;
     IProtocol* _proto;
 
-    bool _shutdown;
+    AtomicBool _shutdown;
     RaptorOptions _options;
 
-    MultiProducerSingleConsumerQueue _mpscq;
-    Thread _mq_thd;
-    Mutex _mutex;
-    ConditionVariable _cv;
-    AtomicUInt32 _count;
+    // lookups in progress (GetConnection, BroadcastAll), Shutdown
+    // waits for them before it frees the slots and the connections
+    AtomicInt32 _lookups;
+
+    // one queue per dispatch thread, the producers signal
+    // cv only when the consumer has set sleeping
+    struct MessageQueue {
+        MultiProducerSingleConsumerQueue mpscq;
+        Thread thd;
+        Mutex mutex;
+        ConditionVariable cv;
+        AtomicUInt32 count;
+        AtomicBool sleeping;
+
+        // above the high watermark, connections whose recv
+        // was skipped are kept in deferred (under deferred_mtx),
+        // once per slot, see ConnectionSlot::deferred
+        AtomicBool paused;
+        Mutex deferred_mtx;
+        std::vector<ConnectionId> deferred;
+    };
+    MessageQueue* _mqs;
+    size_t _mq_count;
+    size_t _high_watermark;
+    size_t _low_watermark;
+
+    // preallocated message nodes, free ones are kept in _free_nodes
+    struct TcpMessageNode* _nodes;
+    IndexStack _free_nodes;
+    AtomicUInt64 _overflow_nodes;
 
     std::shared_ptr<TcpListener> _listener;
-    std::shared_ptr<SendRecvThread> _recv_thread;
-    std::shared_ptr<SendRecvThread> _send_thread;
-
-    Mutex _conn_mtx;
-    std::vector<ConnectionData> _mgr;
-    // key: timeout deadline, value: index for _mgr
-    TimeoutRecord _timeout_record_list;
-    std::list<uint32_t> _free_index_list;
-    uint16_t _magic_number;
-    Atomic<time_t> _last_timeout_time;
+    // _recv_threads[i] and _send_threads[i] make up one shard,
+    // _send_threads is empty in single event loop mode.
+    std::vector<std::shared_ptr<SendRecvThread>> _recv_threads;
+    std::vector<std::shared_ptr<SendRecvThread>> _send_threads;
+
+    // one per shard, swept by its recv thread
+    TimingWheel* _wheels;
+
+    // max_connections slots, read without locking. A slot keeps its
+    // Connection object until Shutdown and reuses it in place.
+    struct ConnectionSlot {
+        Atomic<Connection*> con;
+        // of the current or last connection, part of its id
+        AtomicUInt32 generation;
+        // the id to resume if the slot is in the deferred list of
+        // its queue, under that queue's deferred_mtx
+        ConnectionId deferred;
+    };
+    ConnectionSlot* _slots;
+
+    // preallocate_connections: the objects of all slots
+    uint8_t* _conn_region;
+    size_t _conn_region_size;
+
+    // freed slots, the most recently freed is reused first.
+    // Indexes below _slot_used have been handed out before.
+    IndexStack _free_slots;
+    AtomicUInt32 _slot_used;
 };
 
 } // namespace raptor
@@ -0,0 +1,169 @@
+/*
+ *
+ * Copyright (c) 2020 The Raptor Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "core/package_parser.h"
+#include <string.h>
+#include "core/framing.h"
+#include "raptor/protocol.h"
+#include "util/log.h"
+
+namespace raptor {
+
+PackageParser::PackageParser()
+    : _proto(nullptr)
+    , _pack_len(0)
+    , _peek_size(0)
+    , _scanned(0) {
+    memset(&_framing, 0, sizeof(_framing));
+}
+
+void PackageParser::SetProtocol(IProtocol* proto) {
+    _proto = proto;
+    memset(&_framing, 0, sizeof(_framing));
+    if (proto && !proto->GetFraming(&_framing)) {
+        _framing.type = RAPTOR_FRAMING_NONE;
+    }
+    Reset();
+}
+
+void PackageParser::Reset() {
+    _pack_len = 0;
+    _peek_size = 0;
+    _scanned = 0;
+}
+
+int PackageParser::CheckFramedLength(const SliceBuffer* buf) {
+    size_t cache_size = buf->GetBufferLength();
+    size_t peek_size = core::GetFramingHeaderSize(_framing);
+    if (peek_size > cache_size) {
+        peek_size = cache_size;
+    }
+
+    const Slice& top = buf->At(0);
+    if (top.size() >= peek_size) {
+        return core::CheckFraming(_framing, top.begin(), peek_size);
+    }
+    uint8_t scratch[SCRATCH_SIZE];
+    buf->CopyToBuffer(scratch, peek_size);
+    return core::CheckFraming(_framing, scratch, peek_size);
+}
+
+// Search each byte once, however many calls the package takes
+int PackageParser::ScanDelimiter(const SliceBuffer* buf) {
+    size_t offset = 0;
+    for (const Slice& s : *buf) {
+        if (offset + s.size() > _scanned) {
+            size_t skip = (_scanned > offset) ? _scanned - offset : 0;
+            const uint8_t* p = s.begin() + skip;
+            const void* e = memchr(p, _framing.delimiter, s.size() - skip);
+            if (e) {
+                size_t pack_len = offset + skip + (static_cast<const uint8_t*>(e) - p) + 1;
+                _scanned = 0;
+                if (pack_len > core::GetMaxPackageSize(_framing)) {
+                    return -1;
+                }
+                return static_cast<int>(pack_len);
+            }
+        }
+        offset += s.size();
+    }
+    _scanned = offset;
+    return (_scanned > core::GetMaxPackageSize(_framing)) ? -1 : 0;
+}
+
+int PackageParser::CheckPackageLength(const SliceBuffer* buf) {
+    switch (_framing.type) {
+    case RAPTOR_FRAMING_NONE:
+        break;
+    case RAPTOR_FRAMING_DELIMITER:
+        return ScanDelimiter(buf);
+    default:
+        return CheckFramedLength(buf);
+    }
+
+    size_t cache_size = buf->GetBufferLength();
+    if (_peek_size == 0) {
+        _peek_size = _proto->GetMaxHeaderSize();
+    }
+
+    while (true) {
+        size_t peek_size = (_peek_size < cache_size) ? _peek_size : cache_size;
+
+        // Contiguous fast path, otherwise copy the header out
+        int pack_len = 0;
+        const Slice& top = buf->At(0);
+        if (top.size() >= peek_size) {
+            pack_len = _proto->CheckPackageLength(top.begin(), peek_size);
+        } else if (peek_size <= SCRATCH_SIZE) {
+            uint8_t scratch[SCRATCH_SIZE];
+            buf->CopyToBuffer(scratch, peek_size);
+            pack_len = _proto->CheckPackageLength(scratch, peek_size);
+        } else {
+            Slice s = MakeSliceByLength(peek_size);
+            buf->CopyToBuffer(s.Buffer(), peek_size);
+            pack_len = _proto->CheckPackageLength(s.begin(), peek_size);
+        }
+
+        if (pack_len != 0) {
+            return pack_len;
+        }
+
+        // All the data was shown, wait for more. The peek size
+        // is kept, and grows geometrically while the header does
+        // not fit, so the bytes checked stay linear.
+        if (peek_size == cache_size) {
+            return 0;
+        }
+        _peek_size *= 2;
+    }
+}
+
+int PackageParser::Next(SliceBuffer* buf, Slice* package) {
+    if (buf->Empty()) {
+        return 0;
+    }
+
+    if (_pack_len == 0) {
+        int pack_len = CheckPackageLength(buf);
+        if (pack_len < 0) {
+            log_error("parser: internal protocol error(pack_len = %d)", pack_len);
+            return -1;
+        }
+        if (pack_len == 0) {
+            return 0;
+        }
+        _pack_len = static_cast<size_t>(pack_len);
+    }
+
+    if (buf->GetBufferLength() < _pack_len) {
+        return 0;
+    }
+
+    // Materialize the package once, no copy if it is contiguous
+    const Slice& top = buf->At(0);
+    if (top.size() >= _pack_len) {
+        *package = MakeSubSlice(top, 0, _pack_len);
+    } else {
+        *package = buf->GetHeader(_pack_len);
+    }
+    buf->MoveHeader(_pack_len);
+    Reset();
+    return 1;
+}
+
+} // namespace raptor
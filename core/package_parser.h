@@ -0,0 +1,73 @@
+/*
+ *
+ * Copyright (c) 2020 The Raptor Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __RAPTOR_CORE_PACKAGE_PARSER__
+#define __RAPTOR_CORE_PACKAGE_PARSER__
+
+#include <stddef.h>
+#include "core/slice/slice.h"
+#include "core/slice/slice_buffer.h"
+#include "raptor/types.h"
+
+namespace raptor {
+class IProtocol;
+
+// Splits the bytes of a SliceBuffer into packages.
+// The length of the package in progress is cached, so a large
+// package is checked once and copied at most once, no matter
+// how many slices it arrives in. Built-in framings are parsed
+// inline, without calling the protocol.
+class PackageParser final {
+public:
+    PackageParser();
+    ~PackageParser() = default;
+
+    void SetProtocol(IProtocol* proto);
+
+    // Forget the package in progress, used when the buffer is cleared
+    void Reset();
+
+    // return 1: a package is moved out of buf into *package
+    //        0: need more data, -1: protocol error
+    int Next(SliceBuffer* buf, Slice* package);
+
+private:
+    // return the length of the next package, 0 if unknown yet
+    int CheckPackageLength(const SliceBuffer* buf);
+    int CheckFramedLength(const SliceBuffer* buf);
+    int ScanDelimiter(const SliceBuffer* buf);
+
+    enum { SCRATCH_SIZE = 64 };
+
+    IProtocol* _proto;
+
+    // valid if _framing.type is not RAPTOR_FRAMING_NONE
+    raptor_framing_t _framing;
+
+    // the length of the package in progress, 0 if unknown
+    size_t _pack_len;
+
+    // the bytes to show CheckPackageLength next time
+    size_t _peek_size;
+
+    // the bytes searched for the delimiter so far
+    size_t _scanned;
+};
+
+} // namespace raptor
+#endif  // __RAPTOR_CORE_PACKAGE_PARSER__
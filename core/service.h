@@ -29,6 +29,7 @@ namespace raptor {
 
 class Slice;
 
+class SendRecvThread;
 namespace internal {
 
 // accept
@@ -51,7 +52,8 @@ public:
     virtual void OnErrorEvent(void* ptr) = 0;
     virtual void OnRecvEvent(void* ptr) = 0;
     virtual void OnSendEvent(void* ptr) = 0;
-    virtual void OnCheckingEvent(time_t current) = 0;
+    // called by thd before every epoll_wait
+    virtual void OnCheckingEvent(SendRecvThread* thd, time_t current) = 0;
 };
 
 // for iocp
@@ -68,8 +70,12 @@ class INotificationTransfer {
 public:
     virtual ~INotificationTransfer() {}
     virtual void OnConnectionArrived(ConnectionId cid, const Slice* addr) = 0;
-    virtual void OnDataReceived(ConnectionId cid, const Slice* s) = 0;
+    // s may be moved from
+    virtual void OnDataReceived(ConnectionId cid, Slice&& s) = 0;
     virtual void OnConnectionClosed(ConnectionId cid) = 0;
+    virtual void OnConnectionWritable(ConnectionId cid) {}
+    // Return true to stop reading cid until its recv is resumed
+    virtual bool DeferRecv(ConnectionId cid) { return false; }
 };
 
 } // namespace internal
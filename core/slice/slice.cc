@@ -21,11 +21,12 @@
 #include <algorithm>
 #include "util/alloc.h"
 #include "util/atomic.h"
+#include "util/slab.h"
 
 namespace raptor {
 class SliceRefCount final {
 public:
-    SliceRefCount();
+    explicit SliceRefCount(bool external = false);
     ~SliceRefCount() {}
 
     SliceRefCount(const SliceRefCount&) = delete;
@@ -36,20 +37,48 @@ public:
 
 private:
     AtomicInt32 _refs;
+    // 1: followed by a SliceExternal instead of the bytes
+    int32_t _external;
 };
 
-SliceRefCount::SliceRefCount() {
+struct SliceExternal {
+    void (*release)(void* data, void* arg);
+    void* data;
+    void* arg;
+};
+
+SliceRefCount::SliceRefCount(bool external)
+    : _external(external ? 1 : 0) {
     _refs.Store(1, MemoryOrder::RELEASE);
 }
 
+#ifdef RAPTOR_SLICE_REF_STATS
+static AtomicUInt64 g_slice_ref_ops;
+
+uint64_t GetSliceRefOps() {
+    return g_slice_ref_ops.Load(MemoryOrder::RELAXED);
+}
+#define SLICE_COUNT_REF_OP() g_slice_ref_ops.FetchAdd(1, MemoryOrder::RELAXED)
+#else
+#define SLICE_COUNT_REF_OP() ((void)0)
+#endif
+
 void SliceRefCount::AddRef() {
+    SLICE_COUNT_REF_OP();
     _refs.FetchAdd(1, MemoryOrder::RELAXED);
 }
 
 void SliceRefCount::DecRef() {
+    SLICE_COUNT_REF_OP();
     int32_t n = _refs.FetchSub(1, MemoryOrder::ACQ_REL);
     if (n == 1) {
-        Free(this);
+        if (_external) {
+            SliceExternal* ext = reinterpret_cast<SliceExternal*>(this + 1);
+            if (ext->release) {
+                ext->release(ext->data, ext->arg);
+            }
+        }
+        SlabFree(this);
     }
 }
 
@@ -83,7 +112,7 @@ Slice::Slice(const char* ptr, size_t len) {
             bytes is an array of bytes of the requested length
         */
 
-        _refs = (SliceRefCount*)Malloc(sizeof(SliceRefCount) + len);
+        _refs = (SliceRefCount*)SlabAlloc(sizeof(SliceRefCount) + len);
         new (_refs) SliceRefCount;
         _data.refcounted.length = len;
         _data.refcounted.bytes = reinterpret_cast<uint8_t*>(_refs + 1);
@@ -126,24 +155,23 @@ Slice& Slice::operator= (const Slice& oth) {
     return *this;
 }
 
+// Take over the reference, oth is left empty
 Slice::Slice(Slice&& oth) {
-    if (oth._refs) {
-        oth._refs->AddRef();
-    }
-    _refs = std::move(oth._refs);
-    _data = std::move(oth._data);
+    _refs = oth._refs;
+    _data = oth._data;
+    oth._refs = nullptr;
+    memset(&oth._data, 0, sizeof(oth._data));
 }
 
 Slice& Slice::operator= (Slice&& oth) {
     if (this != &oth) {
-        if (oth._refs) {
-            oth._refs->AddRef();
-        }
         if (_refs) {
             _refs->DecRef();
         }
-        _refs = std::move(oth._refs);
-        _data = std::move(oth._data);
+        _refs = oth._refs;
+        _data = oth._data;
+        oth._refs = nullptr;
+        memset(&oth._data, 0, sizeof(oth._data));
     }
     return *this;
 }
@@ -191,7 +219,7 @@ Slice MakeSliceByLength(size_t len) {
         s._refs = nullptr;
         s._data.inlined.length = static_cast<uint8_t>(len);
     } else {
-        s._refs = (SliceRefCount*)Malloc(sizeof(SliceRefCount) + len);
+        s._refs = (SliceRefCount*)SlabAlloc(sizeof(SliceRefCount) + len);
         new (s._refs) SliceRefCount;
         s._data.refcounted.length = len;
         s._data.refcounted.bytes = reinterpret_cast<uint8_t*>(s._refs + 1);
@@ -234,4 +262,42 @@ Slice operator- (Slice s1, size_t length) {
     }
     return s;
 }
+
+Slice MakeSliceFromExternal(
+    const void* data, size_t len, void (*release)(void*, void*), void* arg) {
+    Slice s;
+    if (len == 0) {
+        if (release) {
+            release(const_cast<void*>(data), arg);
+        }
+        return s;
+    }
+
+    // Always refcounted, even when short enough to be inlined
+    s._refs = (SliceRefCount*)SlabAlloc(sizeof(SliceRefCount) + sizeof(SliceExternal));
+    new (s._refs) SliceRefCount(true);
+    SliceExternal* ext = reinterpret_cast<SliceExternal*>(s._refs + 1);
+    ext->release = release;
+    ext->data = const_cast<void*>(data);
+    ext->arg = arg;
+    s._data.refcounted.length = len;
+    s._data.refcounted.bytes = static_cast<uint8_t*>(const_cast<void*>(data));
+    return s;
+}
+
+Slice MakeSubSlice(const Slice& s, size_t offset, size_t len) {
+    if (offset >= s.size() || len == 0) {
+        return Slice();
+    }
+    if (len > s.size() - offset) {
+        len = s.size() - offset;
+    }
+    if (!s._refs) {
+        return Slice(s.begin() + offset, len);
+    }
+    Slice r = s;
+    r._data.refcounted.length = len;
+    r._data.refcounted.bytes = s._data.refcounted.bytes + offset;
+    return r;
+}
 } // namespace raptor
@@ -73,6 +73,9 @@ private:
     friend Slice MakeSliceByLength(size_t len);
     friend Slice operator+ (Slice s1, Slice s2);
     friend Slice operator- (Slice s1, size_t len);
+    friend Slice MakeSubSlice(const Slice& s, size_t offset, size_t len);
+    friend Slice MakeSliceFromExternal(
+        const void* data, size_t len, void (*release)(void*, void*), void* arg);
 };
 
 // The default length is less than 4096
@@ -87,6 +90,20 @@ Slice operator+ (Slice s1, Slice s2);
 // Remove len bytes from the begin address
 Slice operator- (Slice s1, size_t len);
 
+// Reference len bytes of s starting at offset, the memory
+// of a refcounted slice is shared rather than copied
+Slice MakeSubSlice(const Slice& s, size_t offset, size_t len);
+
+// Reference memory owned by the caller, release(data, arg) is
+// called when the last slice referencing it is gone
+Slice MakeSliceFromExternal(
+    const void* data, size_t len, void (*release)(void*, void*), void* arg);
+
+#ifdef RAPTOR_SLICE_REF_STATS
+// The number of AddRef and DecRef calls on refcounted slices so far
+uint64_t GetSliceRefOps();
+#endif
+
 } // namespace raptor
 
 #endif  // __RAPTOR_EXPORT_SLICE__
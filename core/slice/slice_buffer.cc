@@ -18,12 +18,36 @@
 
 #include "core/slice/slice_buffer.h"
 #include <string.h>
+#include <new>
+#include <utility>
 #include "util/alloc.h"
 #include "util/log.h"
 #include "util/useful.h"
 
 namespace raptor {
 
+// The ring goes through Malloc/Free like the rest of the
+// connection memory, every slot holds a constructed Slice.
+static void DestroyRing(Slice* ring, size_t capacity) {
+    for (size_t i = 0; i < capacity; i++) {
+        ring[i].~Slice();
+    }
+    Free(ring);
+}
+
+SliceBuffer::SliceBuffer()
+    : _ring(nullptr)
+    , _capacity(0)
+    , _head(0)
+    , _count(0)
+    , _length(0) {}
+
+SliceBuffer::~SliceBuffer() {
+    if (_ring) {
+        DestroyRing(_ring, _capacity);
+    }
+}
+
 Slice SliceBuffer::Merge() const {
 
     if (Count() == 0) {
@@ -31,16 +55,16 @@ Slice SliceBuffer::Merge() const {
     }
 
     if (Count() == 1) {
-        return _vs[0];
+        return At(0);
     }
 
     size_t len = GetBufferLength();
     Slice ret = MakeSliceByLength(len);
     uint8_t* buf = ret.Buffer();
-    for (auto it = _vs.begin(); it != _vs.end(); ++it) {
-        size_t blk_size = it->size();
+    for (const Slice& s : *this) {
+        size_t blk_size = s.size();
         if (blk_size > 0) {
-            memcpy(buf, it->begin(), blk_size);
+            memcpy(buf, s.begin(), blk_size);
             buf += blk_size;
         }
     }
@@ -48,21 +72,63 @@ Slice SliceBuffer::Merge() const {
 }
 
 size_t SliceBuffer::Count() const {
-    return _vs.size();
+    return _count;
 }
 
 size_t SliceBuffer::GetBufferLength() const {
     return _length;
 }
 
+Slice* SliceBuffer::PushSlot() {
+    if (_count == _capacity) {
+        size_t capacity = (_capacity == 0) ? INITIAL_CAPACITY : _capacity * 2;
+        Slice* ring = static_cast<Slice*>(Malloc(capacity * sizeof(Slice)));
+        for (size_t i = 0; i < _count; i++) {
+            new (&ring[i]) Slice(std::move(_ring[(_head + i) & (_capacity - 1)]));
+        }
+        for (size_t i = _count; i < capacity; i++) {
+            new (&ring[i]) Slice();
+        }
+        if (_ring) {
+            DestroyRing(_ring, _capacity);
+        }
+        _ring = ring;
+        _capacity = capacity;
+        _head = 0;
+    }
+    Slice* slot = &_ring[(_head + _count) & (_capacity - 1)];
+    _count++;
+    return slot;
+}
+
+bool SliceBuffer::AppendToTail(const Slice& s) {
+    if (_count == 0 || !s._refs) {
+        return false;
+    }
+    Slice& tail = _ring[(_head + _count - 1) & (_capacity - 1)];
+    if (tail._refs != s._refs || tail.end() != s.begin()) {
+        return false;
+    }
+    tail._data.refcounted.length += s.size();
+    _length += s.size();
+    return true;
+}
+
 void SliceBuffer::AddSlice(const Slice& s) {
-    _vs.push_back(s);
+    if (s.Empty() || AppendToTail(s)) {
+        return;
+    }
+    *PushSlot() = s;
     _length += s.size();
 }
 
 void SliceBuffer::AddSlice(Slice&& s) {
-    _vs.push_back(s);
-    _length += s.size();
+    if (s.Empty() || AppendToTail(s)) {
+        return;
+    }
+    size_t len = s.size();
+    *PushSlot() = std::move(s);
+    _length += len;
 }
 
 Slice SliceBuffer::GetHeader(size_t len) {
@@ -75,70 +141,78 @@ Slice SliceBuffer::GetHeader(size_t len) {
     return s;
 }
 
+void SliceBuffer::TrimTop(size_t len) {
+    Slice& top = _ring[_head];
+    if (top._refs) {
+        top._data.refcounted.bytes += len;
+        top._data.refcounted.length -= len;
+    } else {
+        size_t left = top._data.inlined.length - len;
+        memmove(top._data.inlined.bytes, top._data.inlined.bytes + len, left);
+        top._data.inlined.length = static_cast<uint8_t>(left);
+    }
+}
+
 bool SliceBuffer::MoveHeader(size_t len) {
     if(GetBufferLength() < len) {
         return false;
     }
-    if(len == 0) {
-        return true;
-    }
-
-    auto it = _vs.begin();
-    size_t left = it->size();
 
-    if(left > len) {
-        *it = *it - len;
-        _length -= len;
-    } else if(left == len) {
-        _length -= len;
-        _vs.erase(it);
-    } else {
-        // len > left
-        _length -= left;
-        _vs.erase(it);
+    _length -= len;
+    while (len > 0) {
+        Slice& top = _ring[_head];
+        size_t left = top.size();
+        if (left > len) {
+            TrimTop(len);
+            break;
+        }
 
-        return MoveHeader(len - left);
+        // release the slice, the slot is reused
+        top = Slice();
+        _head = (_head + 1) & (_capacity - 1);
+        _count--;
+        len -= left;
     }
     return true;
 }
 
-size_t SliceBuffer::CopyToBuffer(void* buffer, size_t length) {
+size_t SliceBuffer::CopyToBuffer(void* buffer, size_t length) const {
     RAPTOR_ASSERT(length <= GetBufferLength());
 
-    auto it = _vs.begin();
-
     size_t left = length;
     size_t pos = 0;
 
-    while(it != _vs.end() && left != 0) {
-
-        size_t len = RAPTOR_MIN(left, it->size());
-        memcpy((uint8_t*)buffer + pos, it->begin(), len);
+    for (size_t i = 0; i < _count && left != 0; i++) {
+        const Slice& s = At(i);
+        size_t len = RAPTOR_MIN(left, s.size());
+        memcpy((uint8_t*)buffer + pos, s.begin(), len);
 
         left -= len;
         pos += len;
-
-        ++it;
     }
 
     return pos;
 }
 
 void SliceBuffer::ClearBuffer() {
-    _vs.clear();
+    for (size_t i = 0; i < _count; i++) {
+        _ring[(_head + i) & (_capacity - 1)] = Slice();
+    }
+    _head = 0;
+    _count = 0;
     _length = 0;
 }
 
 Slice SliceBuffer::GetTopSlice() const {
-    if (_vs.empty()) {
+    if (_count == 0) {
         return Slice();
     }
-    return _vs[0];
+    return At(0);
 }
 
 Slice SliceBuffer::GetSlice(size_t index) const {
-    if (index < _vs.size()) {
-        return _vs[index];
+    if (index < _count) {
+        return At(index);
     }
     return Slice();
 }
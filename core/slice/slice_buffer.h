@@ -20,16 +20,41 @@
 #define __RAPTOR_CORE_SLICE_BUFFER__
 
 #include <stdint.h>
-#include <vector>
 
 #include "core/slice/slice.h"
 
 namespace raptor {
 
+// A queue of slices kept in a ring, appending and consuming
+// from the front (whole or partial slices) are O(1).
 class SliceBuffer final {
 public:
-    SliceBuffer() : _length(0) {}
-    ~SliceBuffer() = default;
+    // Walks the slices from the front, each one is a contiguous span
+    class Iterator final {
+    public:
+        const Slice& operator*() const { return _buf->At(_index); }
+        const Slice* operator->() const { return &_buf->At(_index); }
+        Iterator& operator++() {
+            ++_index;
+            return *this;
+        }
+        bool operator==(const Iterator& oth) const { return _index == oth._index; }
+        bool operator!=(const Iterator& oth) const { return _index != oth._index; }
+
+    private:
+        friend class SliceBuffer;
+        Iterator(const SliceBuffer* buf, size_t index)
+            : _buf(buf), _index(index) {}
+
+        const SliceBuffer* _buf;
+        size_t _index;
+    };
+
+    SliceBuffer();
+    ~SliceBuffer();
+
+    SliceBuffer(const SliceBuffer&) = delete;
+    SliceBuffer& operator= (const SliceBuffer&) = delete;
 
     Slice Merge() const;
     size_t Count() const;
@@ -44,10 +69,34 @@ public:
     Slice GetTopSlice() const;
     Slice GetSlice(size_t index) const;
 
+    // No bounds check, the reference is valid until the buffer is modified
+    const Slice& At(size_t index) const {
+        return _ring[(_head + index) & (_capacity - 1)];
+    }
+
+    Iterator begin() const { return Iterator(this, 0); }
+    Iterator end() const { return Iterator(this, _count); }
+
+    // Copy the first len bytes to buff without consuming them
+    size_t CopyToBuffer(void* buff, size_t len) const;
+
 private:
-    size_t CopyToBuffer(void* buff, size_t len);
+    enum { INITIAL_CAPACITY = 8 };
+
+    // Extend the last slice if s continues it in the same block
+    bool AppendToTail(const Slice& s);
+
+    // Make room for one more slice, return its slot
+    Slice* PushSlot();
+
+    // Drop the first len bytes of the first slice, len < its size
+    void TrimTop(size_t len);
 
-    std::vector<Slice> _vs;
+    // _capacity is zero or a power of 2
+    Slice* _ring;
+    size_t _capacity;
+    size_t _head;
+    size_t _count;
     size_t _length;
 };
 
@@ -0,0 +1,75 @@
+/*
+ *
+ * Copyright (c) 2020 The Raptor Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "core/timing_wheel.h"
+
+namespace raptor {
+
+TimingWheel::TimingWheel()
+    : _current(0) {}
+
+TimingWheel::~TimingWheel() {}
+
+void TimingWheel::Init(time_t now) {
+    AutoMutex g(&_mtx);
+    _current = now;
+    for (auto& slot : _slots) {
+        slot.clear();
+    }
+}
+
+void TimingWheel::Clear() {
+    AutoMutex g(&_mtx);
+    for (auto& slot : _slots) {
+        std::vector<ConnectionId>().swap(slot);
+    }
+}
+
+void TimingWheel::Add(ConnectionId cid, time_t deadline) {
+    AutoMutex g(&_mtx);
+    if (deadline < _current) {
+        deadline = _current;
+    }
+    _slots[deadline % SLOT_COUNT].push_back(cid);
+}
+
+bool TimingWheel::Expire(time_t now, std::vector<ConnectionId>* due) {
+    AutoMutex g(&_mtx);
+    if (now < _current) {
+        return false;
+    }
+
+    // After a stall longer than the wheel every slot is due once
+    time_t last = now;
+    if (last - _current >= SLOT_COUNT) {
+        last = _current + SLOT_COUNT - 1;
+    }
+    for (; _current <= last; _current++) {
+        auto& slot = _slots[_current % SLOT_COUNT];
+        if (due->empty()) {
+            due->swap(slot);
+        } else {
+            due->insert(due->end(), slot.begin(), slot.end());
+            slot.clear();
+        }
+    }
+    _current = now + 1;
+    return true;
+}
+
+} // namespace raptor
@@ -0,0 +1,64 @@
+/*
+ *
+ * Copyright (c) 2020 The Raptor Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __RAPTOR_CORE_TIMING_WHEEL__
+#define __RAPTOR_CORE_TIMING_WHEEL__
+
+#include <stdint.h>
+#include <time.h>
+#include <vector>
+
+#include "raptor/types.h"
+#include "util/sync.h"
+
+namespace raptor {
+
+// Coarse one-second wheel for connection idle timeouts.
+// The deadlines live on the connections and refreshing one is a
+// plain store. An entry is only looked at when its slot comes
+// round, then the owner either expires it or adds it again with
+// its current deadline.
+class TimingWheel final {
+public:
+    TimingWheel();
+    ~TimingWheel();
+
+    TimingWheel(const TimingWheel&) = delete;
+    TimingWheel& operator= (const TimingWheel&) = delete;
+
+    void Init(time_t now);
+    void Clear();
+
+    // Thread safe, a deadline in the past is due on the next Expire
+    void Add(ConnectionId cid, time_t deadline);
+
+    // Move the entries of the slots up to now into due,
+    // return false if no second has passed since the last call
+    bool Expire(time_t now, std::vector<ConnectionId>* due);
+
+private:
+    enum { SLOT_COUNT = 64 };
+
+    Mutex _mtx;
+    // the next second to expire
+    time_t _current;
+    std::vector<ConnectionId> _slots[SLOT_COUNT];
+};
+
+} // namespace raptor
+#endif  // __RAPTOR_CORE_TIMING_WHEEL__
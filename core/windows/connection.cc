@@ -18,6 +18,7 @@
 
 #include "core/windows/connection.h"
 #include <string.h>
+#include <utility>
 #include "core/socket_util.h"
 #include "core/windows/socket_setting.h"
 #include "raptor/protocol.h"
@@ -115,6 +116,13 @@ bool Connection::SendWithHeader(
     return AsyncSend();
 }
 
+bool Connection::SendSlice(const Slice& s) {
+    if (!IsOnline()) return false;
+    AutoMutex g(&_snd_mtx);
+    _snd_buffer.AddSlice(s);
+    return AsyncSend();
+}
+
 constexpr size_t MAX_PACKAGE_SIZE = 0xffff;
 constexpr size_t MAX_WSABUF_COUNT = 16;
 
@@ -264,7 +272,7 @@ int Connection::ParsingProtocol() {
             size_t n = package.size() - pack_len;
             package.CutTail(n);
         }
-        _service->OnDataReceived(_cid, &package);
+        _service->OnDataReceived(_cid, std::move(package));
         _rcv_buffer.MoveHeader(pack_len);
 
         cache_size = _rcv_buffer.GetBufferLength();
@@ -43,6 +43,7 @@ public:
     void SetProtocol(IProtocol* p);
     void Shutdown(bool notify);
 
+    bool SendSlice(const Slice& s);
     bool SendWithHeader(
         const void* hdr, size_t hdr_len, const void* data, size_t data_len);
     bool IsOnline();
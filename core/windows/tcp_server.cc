@@ -17,6 +17,8 @@
  */
 
 #include "core/windows/tcp_server.h"
+#include <string.h>
+#include <utility>
 #include "core/windows/tcp_listener.h"
 #include "util/alloc.h"
 #include "util/cpu.h"
@@ -29,7 +31,7 @@ enum MessageType {
     kRecvAMessage,
     kCloseClient,
 };
-struct TcpMessageNode {
+struct TcpMessageNode : public AllocatedObject {
     MultiProducerSingleConsumerQueue::Node node;
     MessageType type;
     ConnectionId cid;
@@ -41,7 +43,8 @@ constexpr uint32_t InvalidIndex = static_cast<uint32_t>(-1);
 TcpServer::TcpServer(IServerReceiver *service)
     : _service(service)
     , _proto(nullptr)
-    , _shutdown(true) {
+    , _shutdown(true)
+    , _generation_seed(0) {
 }
 
 TcpServer::~TcpServer() {
@@ -62,13 +65,20 @@ raptor_error TcpServer::Init(const RaptorOptions* options){
         return e;
     }
 
-    e = _rs_thread->Init(2, 0);
+    size_t rs_threads = options->send_recv_threads;
+    if (rs_threads == 0) {
+        rs_threads = DEFAULT_SEND_RECV_THREADS;
+    }
+    e = _rs_thread->Init(rs_threads, 0);
     if (e != RAPTOR_ERROR_NONE) {
         return e;
     }
 
     _shutdown = false;
     _options = *options;
+    if (_options.max_connections == 0) {
+        _options.max_connections = RESERVED_CONNECTION_COUNT;
+    }
     _count.Store(0);
 
     _mq_thd = Thread(
@@ -76,15 +86,18 @@ raptor_error TcpServer::Init(const RaptorOptions* options){
             std::bind(&TcpServer::MessageQueueThread, this, std::placeholders::_1)
             , nullptr);
 
+    // Generations start from the time, ids of an earlier run are not
+    // taken for connections of this one
+    time_t n = Now();
     _conn_mtx.Lock();
+    _generation_seed = static_cast<uint32_t>(n) & core::GenerationMask;
     _mgr.resize(RESERVED_CONNECTION_COUNT);
+    _generations.assign(RESERVED_CONNECTION_COUNT, _generation_seed);
     for (size_t i = 0; i < RESERVED_CONNECTION_COUNT; i++) {
         _free_index_list.push_back(i);
     }
     _conn_mtx.Unlock();
 
-    time_t n = Now();
-    _magic_number = (n >> 16) & 0xffff;
     _last_timeout_time.Store(n);
     return RAPTOR_ERROR_NONE;
 }
@@ -140,6 +153,7 @@ void TcpServer::Shutdown(){
             }
         }
         _mgr.clear();
+        _generations.clear();
         _conn_mtx.Unlock();
 
         // clear message queue
@@ -170,24 +184,92 @@ bool TcpServer::SendWithHeader(ConnectionId cid,
         return false;
     }
 
-    auto con = GetConnection(index);
+    auto con = GetConnection(cid, index);
     if (con) {
         return con->SendWithHeader(hdr, hdr_len, data, data_len);
     }
     return false;
 }
 
-bool TcpServer::CloseConnection(ConnectionId cid){
+bool TcpServer::SendSlice(ConnectionId cid, const Slice& s) {
     uint32_t index = CheckConnectionId(cid);
     if (index == InvalidIndex) {
         return false;
     }
 
-    auto con = GetConnection(index);
+    auto con = GetConnection(cid, index);
     if (con) {
-        con->Shutdown(false);
-        DeleteConnection(index);
+        return con->SendSlice(s);
+    }
+    return false;
+}
+
+// Connections are looked up BROADCAST_BATCH_SIZE at a time under
+// one _conn_mtx, then sent to without holding it. Every send queue
+// references the same slice instead of a copy of the payload.
+size_t TcpServer::Broadcast(const ConnectionId* cids, size_t count, const Slice& s) {
+    std::shared_ptr<Connection> batch[BROADCAST_BATCH_SIZE];
+    size_t sent = 0;
+    size_t i = 0;
+    while (i < count) {
+        size_t n = 0;
+        _conn_mtx.Lock();
+        for (; i < count && n < BROADCAST_BATCH_SIZE; i++) {
+            uint32_t index = CheckConnectionId(cids[i]);
+            if (index != InvalidIndex && IsCurrentConnection(cids[i], index)) {
+                batch[n++] = _mgr[index].first;
+            }
+        }
+        _conn_mtx.Unlock();
+        sent += SendToBatch(batch, n, s);
+    }
+    return sent;
+}
+
+size_t TcpServer::BroadcastAll(const Slice& s) {
+    std::shared_ptr<Connection> batch[BROADCAST_BATCH_SIZE];
+    size_t sent = 0;
+    size_t i = 0;
+    bool more = true;
+    while (more) {
+        size_t n = 0;
+        _conn_mtx.Lock();
+        for (; i < _mgr.size() && n < BROADCAST_BATCH_SIZE; i++) {
+            if (_mgr[i].first) {
+                batch[n++] = _mgr[i].first;
+            }
+        }
+        more = (i < _mgr.size());
+        _conn_mtx.Unlock();
+        sent += SendToBatch(batch, n, s);
+    }
+    return sent;
+}
+
+size_t TcpServer::SendToBatch(
+    std::shared_ptr<Connection>* batch, size_t count, const Slice& s) {
+    size_t sent = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (batch[i]->SendSlice(s)) {
+            sent++;
+        }
+        batch[i].reset();
     }
+    return sent;
+}
+
+bool TcpServer::CloseConnection(ConnectionId cid){
+    uint32_t index = CheckConnectionId(cid);
+    if (index == InvalidIndex) {
+        return false;
+    }
+
+    auto con = GetConnection(cid, index);
+    if (!con) {
+        return false;
+    }
+    con->Shutdown(false);
+    DeleteConnection(cid, index);
     return true;
 }
 
@@ -206,6 +288,7 @@ void TcpServer::OnNewConnection(
         size_t count = _mgr.size();
         size_t expand = ((count * 2) < _options.max_connections) ? (count * 2) : _options.max_connections;
         _mgr.resize(expand);
+        _generations.resize(expand, _generation_seed);
         for (size_t i = count; i < expand; i++) {
             _mgr[i].first = nullptr;
             _mgr[i].second = _timeout_record_list.end();
@@ -216,12 +299,16 @@ void TcpServer::OnNewConnection(
     uint32_t index = _free_index_list.front();
     _free_index_list.pop_front();
 
+    // The old id of the slot no longer matches from here on
+    uint32_t generation = (_generations[index] + 1) & core::GenerationMask;
+    _generations[index] = generation;
     ConnectionId cid = core::BuildConnectionId(
-        _magic_number, static_cast<uint16_t>(listen_port), index);
+        static_cast<uint16_t>(listen_port), generation, index);
 
     time_t deadline_second = Now() + _options.connection_timeout;
 
-    std::shared_ptr<Connection> conn = std::make_shared<Connection>(this);
+    std::shared_ptr<Connection> conn =
+        std::allocate_shared<Connection>(StdAllocator<Connection>(), this);
     conn->Init(cid, sock, addr);
     conn->SetProtocol(_proto);
 
@@ -247,10 +334,10 @@ void TcpServer::OnErrorEvent(void* ptr, size_t ) {
         return;
     }
 
-    auto con = GetConnection(index);
+    auto con = GetConnection(cid, index);
     if (con) {
         con->Shutdown(true);
-        DeleteConnection(index);
+        DeleteConnection(cid, index);
     }
 }
 
@@ -262,14 +349,14 @@ void TcpServer::OnRecvEvent(void* ptr, size_t transferred_bytes) {
         return;
     }
 
-    auto con = GetConnection(index);
+    auto con = GetConnection(cid, index);
     if (!con) return;
     if (con->OnRecvEvent(transferred_bytes)) {
-        RefreshTime(index);
+        RefreshTime(cid, index);
         return;
     }
     con->Shutdown(true);
-    DeleteConnection(index);
+    DeleteConnection(cid, index);
     log_error("tcpserver: Failed to post async recv");
 }
 
@@ -281,14 +368,14 @@ void TcpServer::OnSendEvent(void* ptr, size_t transferred_bytes) {
         return;
     }
 
-    auto con = GetConnection(index);
+    auto con = GetConnection(cid, index);
     if (!con) return;
     if (con->OnSendEvent(transferred_bytes)) {
-        RefreshTime(index);
+        RefreshTime(cid, index);
         return;
     }
     con->Shutdown(true);
-    DeleteConnection(index);
+    DeleteConnection(cid, index);
     log_error("tcpserver: Failed to post async send");
 }
 
@@ -331,10 +418,10 @@ void TcpServer::OnConnectionArrived(ConnectionId cid, const Slice* addr) {
     _cv.Signal();
 }
 
-void TcpServer::OnDataReceived(ConnectionId cid, const Slice* s) {
+void TcpServer::OnDataReceived(ConnectionId cid, Slice&& s) {
     TcpMessageNode* msg = new TcpMessageNode;
     msg->cid = cid;
-    msg->slice = *s;
+    msg->slice = std::move(s);
     msg->type = MessageType::kRecvAMessage;
     _mpscq.push(&msg->node);
     _count.FetchAdd(1, MemoryOrder::ACQ_REL);
@@ -350,9 +437,9 @@ void TcpServer::OnConnectionClosed(ConnectionId cid) {
     _cv.Signal();
 }
 
-void TcpServer::DeleteConnection(uint32_t index) {
+void TcpServer::DeleteConnection(ConnectionId cid, uint32_t index) {
     AutoMutex g(&_conn_mtx);
-    if (!_mgr[index].first) {
+    if (!IsCurrentConnection(cid, index)) {
         return;
     }
     _mgr[index].first.reset();
@@ -361,9 +448,9 @@ void TcpServer::DeleteConnection(uint32_t index) {
     _free_index_list.push_back(index);
 }
 
-void TcpServer::RefreshTime(uint32_t index) {
+void TcpServer::RefreshTime(ConnectionId cid, uint32_t index) {
     AutoMutex g(&_conn_mtx);
-    if (!_mgr[index].first) {
+    if (!IsCurrentConnection(cid, index)) {
         return;
     }
     time_t deadline_seconds = Now() + _options.connection_timeout;
@@ -377,7 +464,7 @@ bool TcpServer::SetUserData(ConnectionId cid, void* ptr) {
         return false;
     }
 
-    auto con = GetConnection(index);
+    auto con = GetConnection(cid, index);
     if (con) {
         con->SetUserData(ptr);
         return true;
@@ -391,7 +478,7 @@ bool TcpServer::GetUserData(ConnectionId cid, void** ptr) {
         return false;
     }
 
-    auto con = GetConnection(index);
+    auto con = GetConnection(cid, index);
     if (con) {
         con->GetUserData(ptr);
         return true;
@@ -405,7 +492,7 @@ bool TcpServer::SetExtendInfo(ConnectionId cid, uint64_t data) {
         return false;
     }
 
-    auto con = GetConnection(index);
+    auto con = GetConnection(cid, index);
     if (con) {
         con->SetExtendInfo(data);
         return true;
@@ -419,7 +506,7 @@ bool TcpServer::GetExtendInfo(ConnectionId cid, uint64_t& data) {
         return false;
     }
 
-    auto con = GetConnection(index);
+    auto con = GetConnection(cid, index);
     if (con) {
         con->GetExtendInfo(data);
         return true;
@@ -433,22 +520,24 @@ int TcpServer::GetPeerString(ConnectionId cid, char* buf, int buf_len) {
         return -1;
     }
 
-    auto con = GetConnection(index);
+    auto con = GetConnection(cid, index);
     if (con) {
         return con->GetPeerString(buf, buf_len);
     }
     return -1;
 }
 
+void TcpServer::GetStats(RaptorServerStats* stats) {
+    memset(stats, 0, sizeof(*stats));
+}
+
+// The slot may hold a newer connection by now,
+// IsCurrentConnection checks the generation under _conn_mtx
 uint32_t TcpServer::CheckConnectionId(ConnectionId cid) const {
     uint32_t failure = InvalidIndex;
     if (cid == core::InvalidConnectionId) {
         return failure;
     }
-    uint16_t magic = core::GetMagicNumber(cid);
-    if (magic != _magic_number) {
-        return failure;
-    }
 
     uint32_t index = core::GetUserId(cid);
     if (index >= _options.max_connections) {
@@ -457,6 +546,13 @@ uint32_t TcpServer::CheckConnectionId(ConnectionId cid) const {
     return index;
 }
 
+// Under _conn_mtx. A cid of an earlier occupant of the
+// slot has an older generation.
+bool TcpServer::IsCurrentConnection(ConnectionId cid, uint32_t index) const {
+    return index < _mgr.size() && _mgr[index].first
+        && _generations[index] == core::GetGeneration(cid);
+}
+
 void TcpServer::MessageQueueThread(void*) {
     while (!_shutdown) {
         RaptorMutexLock(_mutex);
@@ -485,9 +581,16 @@ void TcpServer::Dispatch(struct TcpMessageNode* msg) {
     case MessageType::kNewConnection:
         _service->OnConnected(msg->cid, reinterpret_cast<const char*>(msg->addr.begin()));
         break;
-    case MessageType::kRecvAMessage:
-        _service->OnMessageReceived(msg->cid, msg->slice.begin(), msg->slice.size());
+    case MessageType::kRecvAMessage: {
+        // Through the batch entry, a batch callback replaces
+        // the per-message one
+        raptor_message_t m;
+        m.cid = msg->cid;
+        m.data = msg->slice.begin();
+        m.length = msg->slice.size();
+        _service->OnMessagesReceived(&m, 1);
         break;
+    }
     case MessageType::kCloseClient:
         _service->OnClosed(msg->cid);
         break;
@@ -497,8 +600,11 @@ void TcpServer::Dispatch(struct TcpMessageNode* msg) {
     }
 }
 
-std::shared_ptr<Connection> TcpServer::GetConnection(uint32_t index) {
+std::shared_ptr<Connection> TcpServer::GetConnection(ConnectionId cid, uint32_t index) {
     AutoMutex g(&_conn_mtx);
+    if (!IsCurrentConnection(cid, index)) {
+        return nullptr;
+    }
     auto obj = _mgr[index].first;
     return obj;
 }
@@ -59,6 +59,9 @@ public:
     bool Send(ConnectionId cid, const void* buf, size_t len);
     bool SendWithHeader(ConnectionId cid,
         const void* hdr, size_t hdr_len, const void* data, size_t data_len);
+    bool SendSlice(ConnectionId cid, const Slice& s);
+    size_t Broadcast(const ConnectionId* cids, size_t count, const Slice& s);
+    size_t BroadcastAll(const Slice& s);
     bool CloseConnection(ConnectionId cid);
 
     // internal::IAcceptor impl
@@ -74,7 +77,7 @@ public:
 
     // internal::INotificationTransfer impl
     void OnConnectionArrived(ConnectionId cid, const Slice* addr) override;
-    void OnDataReceived(ConnectionId cid, const Slice* s) override;
+    void OnDataReceived(ConnectionId cid, Slice&& s) override;
     void OnConnectionClosed(ConnectionId cid) override;
 
     // user data
@@ -83,15 +86,18 @@ public:
     bool SetExtendInfo(ConnectionId cid, uint64_t data);
     bool GetExtendInfo(ConnectionId cid, uint64_t& data);
     int GetPeerString(ConnectionId cid, char* buf, int buf_len);
+    void GetStats(RaptorServerStats* stats);
 
 private:
 
     void MessageQueueThread(void*);
     uint32_t CheckConnectionId(ConnectionId cid) const;
     void Dispatch(struct TcpMessageNode* msg);
-    void DeleteConnection(uint32_t index);
-    void RefreshTime(uint32_t index);
-    std::shared_ptr<Connection> GetConnection(uint32_t index);
+    bool IsCurrentConnection(ConnectionId cid, uint32_t index) const;
+    void DeleteConnection(ConnectionId cid, uint32_t index);
+    void RefreshTime(ConnectionId cid, uint32_t index);
+    std::shared_ptr<Connection> GetConnection(ConnectionId cid, uint32_t index);
+    size_t SendToBatch(std::shared_ptr<Connection>* batch, size_t count, const Slice& s);
 
 private:
 
@@ -100,6 +106,8 @@ private:
         std::pair<std::shared_ptr<Connection>, TimeoutRecord::iterator>;
 
     enum { RESERVED_CONNECTION_COUNT = 100 };
+    enum { BROADCAST_BATCH_SIZE = 64 };
+    enum { DEFAULT_SEND_RECV_THREADS = 2 };
 
     IServerReceiver* _service;
     IProtocol* _proto;
@@ -121,7 +129,10 @@ private:
     // key: timeout deadline, value: index for _mgr
     TimeoutRecord _timeout_record_list;
     std::list<uint32_t> _free_index_list;
-    uint16_t _magic_number;
+    // generation of the current or last connection of each slot
+    // in _mgr, part of its id
+    std::vector<uint32_t> _generations;
+    uint32_t _generation_seed;
     Atomic<time_t> _last_timeout_time;
 };
 } // namespace raptor
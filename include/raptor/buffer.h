@@ -0,0 +1,59 @@
+/*
+ *
+ * Copyright (c) 2020 The Raptor Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __RAPTOR_EXPORT_BUFFER__
+#define __RAPTOR_EXPORT_BUFFER__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+#include "raptor/export.h"
+#include "raptor/types.h"
+
+// A refcounted buffer that can be queued to any number of connections
+// without copying (ITcpServer::SendBuffer, raptor_server_send_buffer).
+// Each queued send holds a reference until the kernel has taken the
+// bytes, the creator holds one until raptor_buffer_release.
+
+// Allocate len bytes, fill them through raptor_buffer_data
+RAPTOR_API raptor_buffer_t* raptor_buffer_alloc(size_t len);
+
+// Wrap memory owned by the caller, release(data, arg) is called once
+// the last reference is gone. release may be NULL for static memory.
+// It runs on the thread that drops that reference: the caller of
+// raptor_buffer_release or of a send that wrote directly, an epoll
+// thread that finished the send, or the thread that closed or shut
+// down the connection. It must be thread-safe and must not block.
+RAPTOR_API raptor_buffer_t* raptor_buffer_wrap(
+                                const void* data, size_t len,
+                                raptor_buffer_release_callback release, void* arg);
+
+RAPTOR_API void* raptor_buffer_data(raptor_buffer_t* b);
+RAPTOR_API size_t raptor_buffer_length(const raptor_buffer_t* b);
+
+// Drop the reference of the creator
+RAPTOR_API void raptor_buffer_release(raptor_buffer_t* b);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __RAPTOR_EXPORT_BUFFER__
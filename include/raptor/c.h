@@ -25,6 +25,7 @@ extern "C" {
 
 #include <stddef.h>
 
+#include "raptor/buffer.h"
 #include "raptor/export.h"
 #include "raptor/types.h"
 
@@ -36,6 +37,15 @@ typedef struct raptor_protocol_t raptor_protocol_t;
 typedef void (*raptor_log_callback)(
     const char* file, int line, int level, const char* message);
 
+// Route raptor's memory through user functions, all four are required.
+// general serves the internal allocations, buffers serves the packet
+// buffers (NULL means general). NULL general restores malloc/free.
+// Must be called before raptor_global_init, return 0 if it is too late
+// or an allocator is incomplete.
+RAPTOR_API int raptor_set_allocator(
+                                const raptor_allocator_t* general,
+                                const raptor_allocator_t* buffers);
+
 RAPTOR_API int raptor_global_init();
 RAPTOR_API int raptor_global_cleanup();
 
@@ -52,6 +62,12 @@ RAPTOR_API void raptor_set_log_level(int level);
 // If you want to take over raptor's log output
 RAPTOR_API void raptor_set_log_callback(raptor_log_callback cb);
 
+// ---- memory ----
+
+// Counters of the packet buffer allocator, one entry per size class.
+// Return the number of entries filled (at most RAPTOR_SLAB_CLASS_COUNT)
+RAPTOR_API size_t raptor_get_slab_stats(raptor_slab_stats_t* stats, size_t count);
+
 // ---- server ----
 RAPTOR_API raptor_server_t*
                raptor_server_create(const raptor_options_t* options);
@@ -69,6 +85,18 @@ RAPTOR_API int raptor_server_set_callbacks(
                                 raptor_server_callback_connection_closed on_closed
                                 );
 
+// Called when a send failed on a full send buffer, and
+// the buffer of that connection has drained
+RAPTOR_API int raptor_server_set_writable_callback(
+                                raptor_server_t* s,
+                                raptor_server_callback_connection_writable on_writable);
+
+// Receive the packages of a dispatch wakeup in one call,
+// it replaces the message callback of raptor_server_set_callbacks
+RAPTOR_API int raptor_server_set_batch_callback(
+                                raptor_server_t* s,
+                                raptor_server_callback_messages_received on_messages_received);
+
 RAPTOR_API int raptor_server_send(
                                 raptor_server_t* s,
                                 raptor_connection_t c, const void* data, size_t len);
@@ -79,6 +107,26 @@ RAPTOR_API int raptor_server_send_with_header(
                                 const void* header, size_t header_size,
                                 const void* data, size_t len);
 
+// Queue a reference of b, its bytes are not copied
+RAPTOR_API int raptor_server_send_buffer(
+                                raptor_server_t* s,
+                                raptor_connection_t c,
+                                raptor_buffer_t* b);
+
+// Queue one shared copy of data to each of the count connections
+// (or to all of them), returns the number of connections it was queued to
+RAPTOR_API size_t raptor_server_broadcast(
+                                raptor_server_t* s,
+                                const raptor_connection_t* cs,
+                                size_t count,
+                                const void* data,
+                                size_t len);
+
+RAPTOR_API size_t raptor_server_broadcast_all(
+                                raptor_server_t* s,
+                                const void* data,
+                                size_t len);
+
 RAPTOR_API int raptor_server_set_userdata(
                                 raptor_server_t* s, raptor_connection_t c, void* userdata);
 RAPTOR_API int raptor_server_get_userdata(
@@ -92,6 +140,8 @@ RAPTOR_API int raptor_server_close_connection(
 
 RAPTOR_API int raptor_server_get_peer_string(raptor_server_t* s, raptor_connection_t c, char* output, int size/* recommend >= 128*/ );
 
+RAPTOR_API int raptor_server_get_stats(raptor_server_t* s, raptor_server_stats_t* stats);
+
 RAPTOR_API void raptor_server_destroy(raptor_server_t* s);
 
 // ---- client ----
@@ -126,6 +176,12 @@ RAPTOR_API void raptor_protocol_set_callbacks(
                                 raptor_protocol_callback_check_package_length cb3
                                 );
 
+// Use a built-in framing instead of the callbacks, the
+// protocol must be set to the server or client afterwards
+RAPTOR_API void raptor_protocol_set_framing(
+                                raptor_protocol_t* p,
+                                const raptor_framing_t* framing);
+
 RAPTOR_API void raptor_protocol_destroy(raptor_protocol_t* p);
 
 #ifdef __cplusplus
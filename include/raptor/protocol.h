@@ -20,6 +20,8 @@
 #define __RAPTOR_PROTOCOL__
 
 #include <stddef.h>
+#include "raptor/export.h"
+#include "raptor/types.h"
 
 namespace raptor {
 class IProtocol {
@@ -31,6 +33,26 @@ public:
 
     // return -1: error;  0: need more data; > 0 : pack_len
     virtual int CheckPackageLength(const void* data, size_t len) = 0;
+
+    // Return true if the protocol is a built-in framing, the
+    // library then parses it inline instead of calling the methods
+    // above. Called for every new connection, when the protocol is
+    // set on it, so it must keep returning the same framing.
+    virtual bool GetFraming(raptor_framing_t* framing) { return false; }
+};
+
+// A protocol made of a built-in framing
+class RAPTOR_API FramingProtocol final : public IProtocol {
+public:
+    explicit FramingProtocol(const raptor_framing_t& framing);
+    ~FramingProtocol() {}
+
+    size_t GetMaxHeaderSize() override;
+    int CheckPackageLength(const void* data, size_t len) override;
+    bool GetFraming(raptor_framing_t* framing) override;
+
+private:
+    raptor_framing_t _framing;
 };
 } // namespace raptor
 #endif  // __RAPTOR_PROTOCOL__
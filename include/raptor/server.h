@@ -19,6 +19,7 @@
 #ifndef __RAPTOR_EXPORT_SERVER__
 #define __RAPTOR_EXPORT_SERVER__
 
+#include "raptor/buffer.h"
 #include "raptor/export.h"
 #include "raptor/protocol.h"
 #include "raptor/service.h"
@@ -41,12 +42,17 @@ public:
     bool Send(ConnectionId cid, const void* buff, size_t len) override;
     bool SendWithHeader(ConnectionId cid,
         const void* hdr, size_t hdr_len, const void* data, size_t data_len) override;
+    bool SendBuffer(ConnectionId cid, raptor_buffer_t* buf) override;
+    size_t Broadcast(const ConnectionId* cids, size_t count,
+        const void* data, size_t len) override;
+    size_t BroadcastAll(const void* data, size_t len) override;
     bool CloseConnection(ConnectionId cid) override;
     bool SetUserData(ConnectionId id, void* userdata) override;
     bool GetUserData(ConnectionId id, void** userdata) override;
     bool SetExtendInfo(ConnectionId id, uint64_t info) override;
     bool GetExtendInfo(ConnectionId id, uint64_t* info) override;
     int  GetPeerString(ConnectionId cid, char* output, int len) override;
+    bool GetStats(RaptorServerStats* stats) override;
 
 private:
     TcpServer* _impl;
@@ -30,6 +30,18 @@ public:
     virtual void OnConnected(ConnectionId cid, const char* peer) = 0;
     virtual void OnMessageReceived(ConnectionId cid, const void* s, size_t len) = 0;
     virtual void OnClosed(ConnectionId cid) = 0;
+
+    // The packages drained from a dispatch queue in one wakeup,
+    // in arrival order. Override it to handle them as a batch.
+    virtual void OnMessagesReceived(const raptor_message_t* msgs, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            OnMessageReceived(msgs[i].cid, msgs[i].data, msgs[i].length);
+        }
+    }
+
+    // A Send to cid failed because its send buffer was full,
+    // and the buffer has drained below the low watermark.
+    virtual void OnWritable(ConnectionId cid) {}
 };
 
 class RAPTOR_API ITcpServer {
@@ -39,15 +51,24 @@ public:
     virtual void SetProtocol(IProtocol* proto) = 0;
     virtual bool AddListening(const char* addr) = 0;
     virtual bool Start() = 0;
+    // Other threads may keep calling in while Shutdown runs,
+    // the calls that start after it has begun fail
     virtual void Shutdown() = 0;
     virtual bool Send(ConnectionId cid, const void* buff, size_t len) = 0;
     virtual bool SendWithHeader(ConnectionId cid, const void* hdr, size_t hdr_len, const void* data, size_t data_len) = 0;
+    // Queue a reference of buf without copying it (raptor/buffer.h)
+    virtual bool SendBuffer(ConnectionId cid, raptor_buffer_t* buf) = 0;
+    // Queue one shared copy of data to every cid (or every connection),
+    // returns the number of connections it was queued to
+    virtual size_t Broadcast(const ConnectionId* cids, size_t count, const void* data, size_t len) = 0;
+    virtual size_t BroadcastAll(const void* data, size_t len) = 0;
     virtual bool CloseConnection(ConnectionId cid) = 0;
     virtual bool SetUserData(ConnectionId cid, void* data) = 0;
     virtual bool GetUserData(ConnectionId cid, void** data) = 0;
     virtual bool SetExtendInfo(ConnectionId cid, uint64_t info) = 0;
     virtual bool GetExtendInfo(ConnectionId cid, uint64_t* info) = 0;
     virtual int  GetPeerString(ConnectionId cid, char* output, int len) = 0;
+    virtual bool GetStats(RaptorServerStats* stats) = 0;
 };
 
 class IClientReceiver {
@@ -29,19 +29,132 @@ extern "C" {
 typedef uint64_t ConnectionId;
 typedef uint64_t raptor_connection_t;
 
+// see raptor/buffer.h
+typedef struct raptor_buffer_t raptor_buffer_t;
+typedef void (*raptor_buffer_release_callback)(void* data, void* arg);
+
 typedef struct {
+    // 0 means default (100)
     size_t max_connections;
     size_t send_recv_timeout;
     size_t connection_timeout;
     size_t max_package_per_second;
+
+    // number of epoll/iocp worker threads, 0 means default
+    size_t send_recv_threads;
+
+    // 1: recv and send of a connection are handled by the same
+    //    epoll thread, 0: by a recv thread and a send thread (linux only)
+    int single_event_loop;
+
+    // number of threads calling back IServerReceiver, messages of
+    // the same connection are always delivered by the same thread,
+    // 0 means default (linux only)
+    size_t dispatch_threads;
+
+    // 1: call IServerReceiver directly on the epoll threads instead of
+    //    the dispatch threads, the callbacks must be cheap, non-blocking
+    //    and thread-safe (linux only)
+    int inline_dispatch;
+
+    // number of preallocated message nodes shared by the dispatch
+    // queues, 0 means default (linux only)
+    size_t message_pool_size;
+
+    // When a dispatch queue holds more than high_watermark messages,
+    // its connections stop reading from sockets until the queue drops
+    // to low_watermark (0 means half of high_watermark).
+    // 0 means unbounded (linux only)
+    size_t message_queue_high_watermark;
+    size_t message_queue_low_watermark;
+
+    // Max bytes waiting in the send buffer of a connection, Send fails
+    // beyond it. Once a Send has failed, OnWritable is called when the
+    // buffer drains to send_buffer_low_watermark (0 means half of
+    // max_send_buffer_size). 0 means unbounded (linux only)
+    size_t max_send_buffer_size;
+    size_t send_buffer_low_watermark;
+
+    // 1: construct the objects of all max_connections connections at
+    //    Init, in one contiguous region with each object on its own
+    //    cache lines, backed by huge pages when available (linux only)
+    int preallocate_connections;
 } raptor_options_t;
 
 typedef raptor_options_t RaptorOptions;
 
+// Memory functions, see raptor_set_allocator
+typedef struct {
+    void* (*malloc_fn)(size_t size);
+    void* (*calloc_fn)(size_t count, size_t size);
+    void* (*realloc_fn)(void* ptr, size_t size);
+    void  (*free_fn)(void* ptr);
+} raptor_allocator_t;
+
+typedef enum {
+    RAPTOR_FRAMING_NONE = 0,        // use the protocol callbacks
+    RAPTOR_FRAMING_LENGTH16_BE,     // 2-byte big-endian length prefix
+    RAPTOR_FRAMING_LENGTH16_LE,     // 2-byte little-endian length prefix
+    RAPTOR_FRAMING_LENGTH32_BE,     // 4-byte big-endian length prefix
+    RAPTOR_FRAMING_LENGTH32_LE,     // 4-byte little-endian length prefix
+    RAPTOR_FRAMING_VARINT,          // LEB128 varint length prefix
+    RAPTOR_FRAMING_DELIMITER,       // packages end with a delimiter byte
+} raptor_framing_type_t;
+
+// Built-in framing, parsed by the library without calling back the
+// protocol for each package. The package delivered to the application
+// includes the length prefix or the delimiter.
+typedef struct {
+    raptor_framing_type_t type;
+
+    // 1: the length prefix counts itself, 0: it counts the body only
+    int length_includes_header;
+
+    // used by RAPTOR_FRAMING_DELIMITER, e.g. '\n'
+    char delimiter;
+
+    // a longer package is a protocol error, 0 means INT_MAX
+    size_t max_package_size;
+} raptor_framing_t;
+
+typedef struct {
+    // preallocated message nodes
+    size_t message_pool_capacity;
+    // message nodes currently taken from the pool
+    size_t message_pool_in_use;
+    // messages allocated from the heap because the pool was exhausted
+    size_t message_pool_overflow;
+} raptor_server_stats_t;
+
+typedef raptor_server_stats_t RaptorServerStats;
+
+// Size classes of the packet buffer allocator, 64 bytes to 64 KB
+#define RAPTOR_SLAB_CLASS_COUNT 11
+
+typedef struct {
+    size_t block_size;
+    uint64_t allocs;
+    uint64_t frees;
+    // frees by a thread other than the one that allocated the block
+    uint64_t remote_frees;
+    // allocations that missed the cache and went to the system
+    uint64_t system_allocs;
+} raptor_slab_stats_t;
+
 // server callback
 typedef void (*raptor_server_callback_connection_arrived)(raptor_connection_t c, const char* peer);
 typedef void (*raptor_server_callback_connection_closed)(raptor_connection_t c);
 typedef void (*raptor_server_callback_message_received)(raptor_connection_t c, const void* buffer, size_t length);
+typedef void (*raptor_server_callback_connection_writable)(raptor_connection_t c);
+
+// A received package, data is valid during the callback only
+typedef struct {
+    raptor_connection_t cid;
+    const void* data;
+    size_t length;
+} raptor_message_t;
+
+typedef void (*raptor_server_callback_messages_received)(const raptor_message_t* msgs, size_t count);
 
 // client callback
 typedef void (*raptor_client_callback_connect_result)(int result);
@@ -17,6 +17,9 @@
  */
 
 #include "surface/adapter.h"
+#include "surface/buffer.h"
+#include <string.h>
+#include "core/framing.h"
 #ifdef _WIN32
 #include "core/windows/tcp_server.h"
 #include "core/windows/tcp_client.h"
@@ -30,7 +33,12 @@
 #include "util/useful.h"
 
 RaptorServerAdapter::RaptorServerAdapter()
-    : _impl(std::make_shared<raptor::TcpServer>(this)) {
+    : _impl(std::make_shared<raptor::TcpServer>(this))
+    , _on_arrived_cb(nullptr)
+    , _on_message_received_cb(nullptr)
+    , _on_closed_cb(nullptr)
+    , _on_writable_cb(nullptr)
+    , _on_messages_received_cb(nullptr) {
 }
 
 RaptorServerAdapter::~RaptorServerAdapter() {}
@@ -84,6 +92,22 @@ bool RaptorServerAdapter::SendWithHeader(
     return _impl->SendWithHeader(cid, hdr, hdr_len, data, data_len);
 }
 
+bool RaptorServerAdapter::SendBuffer(ConnectionId cid, raptor_buffer_t* buf) {
+    if (!buf) return false;
+    return _impl->SendSlice(cid, buf->slice);
+}
+
+size_t RaptorServerAdapter::Broadcast(const ConnectionId* cids, size_t count,
+    const void* data, size_t len) {
+    if (!cids || count == 0 || !data || len == 0) return 0;
+    return _impl->Broadcast(cids, count, raptor::Slice(data, len));
+}
+
+size_t RaptorServerAdapter::BroadcastAll(const void* data, size_t len) {
+    if (!data || len == 0) return 0;
+    return _impl->BroadcastAll(raptor::Slice(data, len));
+}
+
 bool RaptorServerAdapter::CloseConnection(ConnectionId cid) {
     return _impl->CloseConnection(cid);
 }
@@ -100,12 +124,30 @@ void RaptorServerAdapter::OnMessageReceived(ConnectionId id, const void* buff, s
     }
 }
 
+void RaptorServerAdapter::OnMessagesReceived(const raptor_message_t* msgs, size_t count) {
+    if (_on_messages_received_cb) {
+        _on_messages_received_cb(msgs, count);
+        return;
+    }
+    if (_on_message_received_cb) {
+        for (size_t i = 0; i < count; i++) {
+            _on_message_received_cb(msgs[i].cid, msgs[i].data, msgs[i].length);
+        }
+    }
+}
+
 void RaptorServerAdapter::OnClosed(ConnectionId id) {
     if (_on_closed_cb) {
         _on_closed_cb(id);
     }
 }
 
+void RaptorServerAdapter::OnWritable(ConnectionId id) {
+    if (_on_writable_cb) {
+        _on_writable_cb(id);
+    }
+}
+
 // callbacks
 void RaptorServerAdapter::SetCallbacks(
                                     raptor_server_callback_connection_arrived on_arrived,
@@ -117,6 +159,16 @@ void RaptorServerAdapter::SetCallbacks(
     _on_closed_cb = on_closed;
 }
 
+void RaptorServerAdapter::SetWritableCallback(
+                                    raptor_server_callback_connection_writable on_writable) {
+    _on_writable_cb = on_writable;
+}
+
+void RaptorServerAdapter::SetBatchCallback(
+                                    raptor_server_callback_messages_received on_messages_received) {
+    _on_messages_received_cb = on_messages_received;
+}
+
 // user data
 bool RaptorServerAdapter::SetUserData(ConnectionId id, void* userdata) {
     return _impl->SetUserData(id, userdata);
@@ -141,6 +193,12 @@ int RaptorServerAdapter::GetPeerString(ConnectionId cid, char* output, int len)
     if (!output || len <= 0) return -1;
     return _impl->GetPeerString(cid, output, len);
 }
+
+bool RaptorServerAdapter::GetStats(RaptorServerStats* stats) {
+    if (!stats) return false;
+    _impl->GetStats(stats);
+    return true;
+}
 // --------------------------------
 
 RaptorClientAdapter::RaptorClientAdapter()
@@ -212,18 +270,39 @@ void RaptorClientAdapter::SetCallbacks(
 RaptorProtocolAdapter::RaptorProtocolAdapter() {
     _get_max_header_size = nullptr;
     _check_package_length = nullptr;
+    memset(&_framing, 0, sizeof(_framing));
 }
 
 // Get the max header size of current protocol
 size_t RaptorProtocolAdapter::GetMaxHeaderSize() {
+    if (_framing.type != RAPTOR_FRAMING_NONE) {
+        return raptor::core::GetFramingHeaderSize(_framing);
+    }
     return _get_max_header_size();
 }
 
 // return -1: error;  0: need more data; > 0 : pack_len
 int RaptorProtocolAdapter::CheckPackageLength(const void* data, size_t len) {
+    if (_framing.type != RAPTOR_FRAMING_NONE) {
+        return raptor::core::CheckFraming(
+            _framing, static_cast<const uint8_t*>(data), len);
+    }
     return _check_package_length(data, len);
 }
 
+bool RaptorProtocolAdapter::GetFraming(raptor_framing_t* framing) {
+    *framing = _framing;
+    return _framing.type != RAPTOR_FRAMING_NONE;
+}
+
+void RaptorProtocolAdapter::SetFraming(const raptor_framing_t* framing) {
+    if (framing) {
+        _framing = *framing;
+    } else {
+        memset(&_framing, 0, sizeof(_framing));
+    }
+}
+
 void RaptorProtocolAdapter::SetCallbacks(
         raptor_protocol_callback_get_max_header_size cb1,
         raptor_protocol_callback_check_package_length cb3) {
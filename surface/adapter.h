@@ -43,17 +43,23 @@ public:
     void Shutdown() override;
     bool Send(ConnectionId cid, const void* buff, size_t len) override;
     bool SendWithHeader(ConnectionId cid, const void* hdr, size_t hdr_len, const void* data, size_t data_len) override;
+    bool SendBuffer(ConnectionId cid, raptor_buffer_t* buf) override;
+    size_t Broadcast(const ConnectionId* cids, size_t count, const void* data, size_t len) override;
+    size_t BroadcastAll(const void* data, size_t len) override;
     bool CloseConnection(ConnectionId cid) override;
     bool SetUserData(ConnectionId id, void* userdata) override;
     bool GetUserData(ConnectionId id, void** userdata) override;
     bool SetExtendInfo(ConnectionId id, uint64_t info) override;
     bool GetExtendInfo(ConnectionId id, uint64_t* info) override;
     int  GetPeerString(ConnectionId cid, char* output, int len) override;
+    bool GetStats(RaptorServerStats* stats) override;
 
     // IServerReceiver impl
 	void OnConnected(ConnectionId id, const char* peer) override;
     void OnMessageReceived(ConnectionId id, const void* buff, size_t len) override;
+    void OnMessagesReceived(const raptor_message_t* msgs, size_t count) override;
     void OnClosed(ConnectionId id) override;
+    void OnWritable(ConnectionId id) override;
 
     // callbacks (c.h)
     void SetCallbacks(
@@ -61,12 +67,16 @@ public:
                     raptor_server_callback_message_received on_message_received,
                     raptor_server_callback_connection_closed on_closed
                     );
+    void SetWritableCallback(raptor_server_callback_connection_writable on_writable);
+    void SetBatchCallback(raptor_server_callback_messages_received on_messages_received);
 
 private:
     std::shared_ptr<raptor::TcpServer> _impl;
     raptor_server_callback_connection_arrived _on_arrived_cb;
     raptor_server_callback_message_received   _on_message_received_cb;
     raptor_server_callback_connection_closed  _on_closed_cb;
+    raptor_server_callback_connection_writable _on_writable_cb;
+    raptor_server_callback_messages_received  _on_messages_received_cb;
 };
 
 class RaptorClientAdapter final : public raptor::ITcpClient
@@ -111,12 +121,16 @@ public:
     // return -1: error;  0: need more data; > 0 : pack_len
     int CheckPackageLength(const void* data, size_t len) override;
 
+    bool GetFraming(raptor_framing_t* framing) override;
+
     void SetCallbacks(
         raptor_protocol_callback_get_max_header_size get_max_header_size,
         raptor_protocol_callback_check_package_length check_package_length
     );
+    void SetFraming(const raptor_framing_t* framing);
 
 private:
+    raptor_framing_t _framing;
     raptor_protocol_callback_get_max_header_size _get_max_header_size;
     raptor_protocol_callback_check_package_length _check_package_length;
 };
@@ -0,0 +1,47 @@
+/*
+ *
+ * Copyright (c) 2020 The Raptor Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "surface/buffer.h"
+
+using namespace raptor;
+
+raptor_buffer_t* raptor_buffer_alloc(size_t len) {
+    raptor_buffer_t* b = new raptor_buffer_t;
+    b->slice = MakeSliceByLength(len);
+    return b;
+}
+
+raptor_buffer_t* raptor_buffer_wrap(
+    const void* data, size_t len,
+    raptor_buffer_release_callback release, void* arg) {
+    raptor_buffer_t* b = new raptor_buffer_t;
+    b->slice = MakeSliceFromExternal(data, len, release, arg);
+    return b;
+}
+
+void* raptor_buffer_data(raptor_buffer_t* b) {
+    return b ? b->slice.Buffer() : nullptr;
+}
+
+size_t raptor_buffer_length(const raptor_buffer_t* b) {
+    return b ? b->slice.size() : 0;
+}
+
+void raptor_buffer_release(raptor_buffer_t* b) {
+    delete b;
+}
@@ -0,0 +1,31 @@
+/*
+ *
+ * Copyright (c) 2020 The Raptor Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __RAPTOR_SURFACE_BUFFER__
+#define __RAPTOR_SURFACE_BUFFER__
+
+#include "raptor/buffer.h"
+#include "core/slice/slice.h"
+#include "util/alloc.h"
+
+// The reference of the creator, sends take their own
+struct raptor_buffer_t : public raptor::AllocatedObject {
+    raptor::Slice slice;
+};
+
+#endif  // __RAPTOR_SURFACE_BUFFER__
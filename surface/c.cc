@@ -19,8 +19,10 @@
 #include "raptor/c.h"
 #include "core/sockaddr.h"
 #include "surface/adapter.h"
+#include "util/alloc.h"
 #include "util/atomic.h"
 #include "util/log.h"
+#include "util/slab.h"
 #include "util/useful.h"
 
 struct raptor_server_t   { RaptorServerAdapter   * server;  };
@@ -29,6 +31,22 @@ struct raptor_protocol_t { RaptorProtocolAdapter * proto;   };
 
 using namespace raptor;
 static Atomic<uintptr_t> g_log_transfer(0);
+static AtomicBool g_initialized(false);
+
+int raptor_set_allocator(
+    const raptor_allocator_t* general, const raptor_allocator_t* buffers) {
+    if (g_initialized.Load()) {
+        return 0;
+    }
+    const raptor_allocator_t* allocators[] = { general, buffers };
+    for (auto a : allocators) {
+        if (a && (!a->malloc_fn || !a->calloc_fn || !a->realloc_fn || !a->free_fn)) {
+            return 0;
+        }
+    }
+    SetAllocator(general, buffers);
+    return 1;
+}
 
 int raptor_global_init() {
 #ifdef _WIN32
@@ -37,6 +55,7 @@ int raptor_global_init() {
     RAPTOR_ASSERT(status == 0);
 #endif
     raptor::LogInit();
+    g_initialized.Store(true);
     return 0;
 }
 
@@ -84,6 +103,13 @@ void raptor_set_log_callback(raptor_log_callback cb) {
     }
 }
 
+size_t raptor_get_slab_stats(raptor_slab_stats_t* stats, size_t count) {
+    if (!stats || count == 0) {
+        return 0;
+    }
+    return SlabGetStats(stats, count);
+}
+
 // ---- server ----
 raptor_server_t*
     raptor_server_create(const raptor_options_t* options) {
@@ -137,6 +163,26 @@ int raptor_server_set_callbacks(
     return 0;
 }
 
+int raptor_server_set_writable_callback(
+                                raptor_server_t* s,
+                                raptor_server_callback_connection_writable on_writable) {
+    if (s) {
+        s->server->SetWritableCallback(on_writable);
+        return 1;
+    }
+    return 0;
+}
+
+int raptor_server_set_batch_callback(
+                                raptor_server_t* s,
+                                raptor_server_callback_messages_received on_messages_received) {
+    if (s) {
+        s->server->SetBatchCallback(on_messages_received);
+        return 1;
+    }
+    return 0;
+}
+
 int raptor_server_send(
     raptor_server_t* s,
     raptor_connection_t c, const void* data, size_t len) {
@@ -157,6 +203,38 @@ int raptor_server_send_with_header(
     return 0;
 }
 
+int raptor_server_send_buffer(
+                                raptor_server_t* s,
+                                raptor_connection_t c,
+                                raptor_buffer_t* b) {
+    if (s) {
+        return s->server->SendBuffer(c, b) ? 1 : 0;
+    }
+    return 0;
+}
+
+size_t raptor_server_broadcast(
+                                raptor_server_t* s,
+                                const raptor_connection_t* cs,
+                                size_t count,
+                                const void* data,
+                                size_t len) {
+    if (s) {
+        return s->server->Broadcast(cs, count, data, len);
+    }
+    return 0;
+}
+
+size_t raptor_server_broadcast_all(
+                                raptor_server_t* s,
+                                const void* data,
+                                size_t len) {
+    if (s) {
+        return s->server->BroadcastAll(data, len);
+    }
+    return 0;
+}
+
 int raptor_server_set_userdata(
     raptor_server_t* s, raptor_connection_t c, void* userdata) {
     if (s) {
@@ -203,6 +281,13 @@ int raptor_server_get_peer_string(raptor_server_t* s, raptor_connection_t c, cha
     return -1;
 }
 
+int raptor_server_get_stats(raptor_server_t* s, raptor_server_stats_t* stats) {
+    if (s) {
+        return s->server->GetStats(stats) ? 1 : 0;
+    }
+    return 0;
+}
+
 void raptor_server_destroy(raptor_server_t* s) {
     if (s) {
         delete s->server;
@@ -286,6 +371,12 @@ void raptor_protocol_set_callbacks(
     p->proto->SetCallbacks(cb1, cb3);
 }
 
+void raptor_protocol_set_framing(
+                                raptor_protocol_t* p,
+                                const raptor_framing_t* framing) {
+    p->proto->SetFraming(framing);
+}
+
 void raptor_protocol_destroy(raptor_protocol_t* p) {
     delete p->proto;
     delete p;
@@ -0,0 +1,40 @@
+/*
+ *
+ * Copyright (c) 2020 The Raptor Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "raptor/protocol.h"
+#include "core/framing.h"
+
+namespace raptor {
+
+FramingProtocol::FramingProtocol(const raptor_framing_t& framing)
+    : _framing(framing) {}
+
+size_t FramingProtocol::GetMaxHeaderSize() {
+    return core::GetFramingHeaderSize(_framing);
+}
+
+int FramingProtocol::CheckPackageLength(const void* data, size_t len) {
+    return core::CheckFraming(_framing, static_cast<const uint8_t*>(data), len);
+}
+
+bool FramingProtocol::GetFraming(raptor_framing_t* framing) {
+    *framing = _framing;
+    return true;
+}
+
+} // namespace raptor
@@ -24,6 +24,7 @@
 #include "core/linux/tcp_server.h"
 #endif
 
+#include "surface/buffer.h"
 #include "util/log.h"
 #include "util/status.h"
 
@@ -93,6 +94,22 @@ bool Server::SendWithHeader(ConnectionId cid,
     return _impl->SendWithHeader(cid, hdr, hdr_len, data, data_len);
 }
 
+bool Server::SendBuffer(ConnectionId cid, raptor_buffer_t* buf) {
+    if (!buf) return false;
+    return _impl->SendSlice(cid, buf->slice);
+}
+
+size_t Server::Broadcast(const ConnectionId* cids, size_t count,
+    const void* data, size_t len) {
+    if (!cids || count == 0 || !data || len == 0) return 0;
+    return _impl->Broadcast(cids, count, Slice(data, len));
+}
+
+size_t Server::BroadcastAll(const void* data, size_t len) {
+    if (!data || len == 0) return 0;
+    return _impl->BroadcastAll(Slice(data, len));
+}
+
 bool Server::CloseConnection(ConnectionId cid) {
     return _impl->CloseConnection(cid);
 }
@@ -119,6 +136,12 @@ bool Server::GetExtendInfo(ConnectionId id, uint64_t* info) {
 int  Server::GetPeerString(ConnectionId cid, char* output, int len) {
     return _impl->GetPeerString(cid, output, len);
 }
+
+bool Server::GetStats(RaptorServerStats* stats) {
+    if (!stats) return false;
+    _impl->GetStats(stats);
+    return true;
+}
 } // namespace raptor
 
 raptor::ITcpServer* RaptorCreateServer(raptor::IServerReceiver* s) {
@@ -0,0 +1,131 @@
+/*
+ *
+ * Copyright (c) 2020 The Raptor Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+// The dispatch thread is held in the first callback while a client
+// keeps sending. The queue must stop growing near the high watermark,
+// then every package arrives once the callback is released.
+
+#include <string.h>
+
+#include <condition_variable>
+#include <thread>
+#include <vector>
+
+#include "raptor/c.h"
+#include "raptor/protocol.h"
+#include "raptor/server.h"
+#include "tests/loopback.h"
+#include "util/testutil.h"
+
+namespace raptor {
+namespace {
+
+constexpr int BACKPRESSURE_PORT = 50064;
+constexpr size_t HIGH_WATERMARK = 64;
+constexpr size_t LOW_WATERMARK = 16;
+constexpr size_t PACKAGE_COUNT = 2000;
+constexpr size_t PACKAGE_SIZE = 1024;
+// one recv block holds this many packages, they are all queued
+// before the recv path checks the watermark again
+constexpr size_t RECV_BLOCK_PACKAGES = 16;
+
+class GatedService final : public test::RecordingService {
+public:
+    void OnMessageReceived(ConnectionId cid, const void* s, size_t len) override {
+        {
+            std::unique_lock<std::mutex> g(_gate_mtx);
+            _gate_cv.wait(g, [this]() { return _open; });
+        }
+        RecordingService::OnMessageReceived(cid, s, len);
+    }
+
+    void Open() {
+        std::lock_guard<std::mutex> g(_gate_mtx);
+        _open = true;
+        _gate_cv.notify_all();
+    }
+
+private:
+    std::mutex _gate_mtx;
+    std::condition_variable _gate_cv;
+    bool _open = false;
+};
+
+size_t QueuedMessages(Server* server) {
+    RaptorServerStats stats;
+    server->GetStats(&stats);
+    return stats.message_pool_in_use;
+}
+
+class BackpressureTest {};
+
+}  // namespace
+
+TEST(BackpressureTest, ReadsStopAboveHighWatermarkAndResume) {
+    raptor_global_init();
+
+    FramingProtocol proto(test::MakeLength16Framing());
+    RaptorOptions options;
+    memset(&options, 0, sizeof(options));
+    options.connection_timeout = 60;
+    options.dispatch_threads = 1;
+    options.message_queue_high_watermark = HIGH_WATERMARK;
+    options.message_queue_low_watermark = LOW_WATERMARK;
+
+    GatedService service;
+    Server server(&service);
+    ASSERT_TRUE(server.Init(&options));
+    server.SetProtocol(&proto);
+    ASSERT_TRUE(server.AddListening("127.0.0.1:50064"));
+    ASSERT_TRUE(server.Start());
+
+    int fd = test::ConnectLoopback(BACKPRESSURE_PORT);
+    ASSERT_GE(fd, 0);
+
+    std::vector<char> out(PACKAGE_SIZE * PACKAGE_COUNT, 'b');
+    for (size_t i = 0; i < PACKAGE_COUNT; i++) {
+        out[i * PACKAGE_SIZE] = static_cast<char>((PACKAGE_SIZE - 2) >> 8);
+        out[i * PACKAGE_SIZE + 1] = static_cast<char>((PACKAGE_SIZE - 2) & 0xff);
+    }
+    // Blocks once the kernel buffers are full, until reads resume
+    bool sent = false;
+    std::thread writer([&]() { sent = test::SendAll(fd, out.data(), out.size()); });
+
+    // The connection message may still be counted by the queue
+    // while its node is already free, it is one below then
+    ASSERT_TRUE(test::WaitFor([&]() { return QueuedMessages(&server) >= HIGH_WATERMARK - 1; }));
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    size_t queued = QueuedMessages(&server);
+    ASSERT_LE(queued, HIGH_WATERMARK + RECV_BLOCK_PACKAGES + 1);
+    ASSERT_EQ(service.Messages(), 0u);
+
+    service.Open();
+    ASSERT_TRUE(test::WaitFor([&]() { return service.Messages() == PACKAGE_COUNT; }));
+    writer.join();
+    ASSERT_TRUE(sent);
+    ASSERT_EQ(QueuedMessages(&server), 0u);
+
+    close(fd);
+    server.Shutdown();
+}
+
+}  // namespace raptor
+
+int main(int argc, char** argv) {
+    return raptor::test::RunAllTests();
+}
@@ -0,0 +1,160 @@
+/*
+ *
+ * Copyright (c) 2020 The Raptor Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+// The release callback of a wrapped buffer runs exactly once, after
+// the creator and every queued send have dropped their references,
+// whichever of them is the last.
+
+#include <string.h>
+
+#include <atomic>
+#include <vector>
+
+#include "raptor/buffer.h"
+#include "raptor/c.h"
+#include "raptor/protocol.h"
+#include "raptor/server.h"
+#include "tests/loopback.h"
+#include "util/testutil.h"
+
+namespace raptor {
+namespace {
+
+constexpr int BUFFER_PORT = 50065;
+constexpr size_t CLIENT_COUNT = 3;
+constexpr size_t SMALL_BUFFER_SIZE = 1024;
+// far more than the kernel buffers of a loopback connection hold
+constexpr size_t LARGE_BUFFER_SIZE = 8 * 1024 * 1024;
+
+struct ReleaseRecord {
+    std::atomic<int> calls;
+    const void* data;
+};
+
+void OnRelease(void* data, void* arg) {
+    ReleaseRecord* r = static_cast<ReleaseRecord*>(arg);
+    r->data = data;
+    r->calls.fetch_add(1);
+}
+
+class BufferTest {
+public:
+    BufferTest() : _server(&_service) {
+        raptor_global_init();
+        memset(&_options, 0, sizeof(_options));
+        _options.connection_timeout = 60;
+    }
+
+    void Start() {
+        ASSERT_TRUE(_server.Init(&_options));
+        _server.SetProtocol(&_proto);
+        ASSERT_TRUE(_server.AddListening("127.0.0.1:50065"));
+        ASSERT_TRUE(_server.Start());
+    }
+
+    // Return the fds, the ids are in the same order
+    std::vector<int> Connect(size_t count, int rcvbuf, std::vector<ConnectionId>* cids) {
+        std::vector<int> fds;
+        for (size_t i = 0; i < count; i++) {
+            int fd = test::ConnectLoopback(BUFFER_PORT, rcvbuf);
+            ASSERT_GE(fd, 0);
+            fds.push_back(fd);
+            ASSERT_TRUE(test::WaitFor(
+                [&]() { return _service.Connected().size() == i + 1; }));
+        }
+        *cids = _service.Connected();
+        return fds;
+    }
+
+    RaptorOptions _options;
+    FramingProtocol _proto{test::MakeLength16Framing()};
+    test::RecordingService _service;
+    Server _server;
+};
+
+}  // namespace
+
+TEST(BufferTest, CreatorReleasesLast) {
+    Start();
+    std::vector<ConnectionId> cids;
+    std::vector<int> fds = Connect(CLIENT_COUNT, 0, &cids);
+
+    std::vector<char> data(SMALL_BUFFER_SIZE, 's');
+    ReleaseRecord record;
+    record.calls = 0;
+    record.data = nullptr;
+    raptor_buffer_t* b = raptor_buffer_wrap(data.data(), data.size(), OnRelease, &record);
+    for (size_t i = 0; i < CLIENT_COUNT; i++) {
+        ASSERT_TRUE(_server.SendBuffer(cids[i], b));
+    }
+
+    // Every send is done, the creator still holds its reference
+    std::vector<char> in(data.size());
+    for (size_t i = 0; i < CLIENT_COUNT; i++) {
+        ASSERT_EQ(test::RecvAll(fds[i], in.data(), in.size()), in.size());
+        ASSERT_EQ(memcmp(in.data(), data.data(), data.size()), 0);
+    }
+    ASSERT_EQ(record.calls.load(), 0);
+
+    // The last reference, released on this thread
+    raptor_buffer_release(b);
+    ASSERT_EQ(record.calls.load(), 1);
+    ASSERT_TRUE(record.data == data.data());
+
+    for (int fd : fds) {
+        close(fd);
+    }
+    _server.Shutdown();
+    ASSERT_EQ(record.calls.load(), 1);
+}
+
+TEST(BufferTest, QueuedSendReleasesLast) {
+    Start();
+    std::vector<ConnectionId> cids;
+    std::vector<int> fds = Connect(1, 4096, &cids);
+
+    std::vector<char> data(LARGE_BUFFER_SIZE);
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = static_cast<char>(i * 7);
+    }
+    ReleaseRecord record;
+    record.calls = 0;
+    record.data = nullptr;
+    raptor_buffer_t* b = raptor_buffer_wrap(data.data(), data.size(), OnRelease, &record);
+    ASSERT_TRUE(_server.SendBuffer(cids[0], b));
+
+    // The client has not read, most of the buffer is still queued
+    raptor_buffer_release(b);
+    ASSERT_EQ(record.calls.load(), 0);
+
+    std::vector<char> in(data.size());
+    ASSERT_EQ(test::RecvAll(fds[0], in.data(), in.size()), in.size());
+    ASSERT_TRUE(in == data);
+    ASSERT_TRUE(test::WaitFor([&]() { return record.calls.load() == 1; }));
+    ASSERT_TRUE(record.data == data.data());
+
+    close(fds[0]);
+    _server.Shutdown();
+    ASSERT_EQ(record.calls.load(), 1);
+}
+
+}  // namespace raptor
+
+int main(int argc, char** argv) {
+    return raptor::test::RunAllTests();
+}
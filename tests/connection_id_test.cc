@@ -0,0 +1,107 @@
+/*
+ *
+ * Copyright (c) 2020 The Raptor Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+// With one slot, the second connection reuses the slot of the first.
+// The id of the first connection must not reach the second.
+
+#include <string.h>
+
+#include "core/cid.h"
+#include "raptor/c.h"
+#include "raptor/protocol.h"
+#include "raptor/server.h"
+#include "tests/loopback.h"
+#include "util/testutil.h"
+
+namespace raptor {
+namespace {
+
+constexpr int CONNECTION_ID_PORT = 50063;
+
+class ConnectionIdTest {};
+
+}  // namespace
+
+TEST(ConnectionIdTest, StaleIdIsRejected) {
+    raptor_global_init();
+
+    FramingProtocol proto(test::MakeLength16Framing());
+    RaptorOptions options;
+    memset(&options, 0, sizeof(options));
+    options.max_connections = 1;
+    options.connection_timeout = 60;
+
+    test::RecordingService service;
+    Server server(&service);
+    ASSERT_TRUE(server.Init(&options));
+    server.SetProtocol(&proto);
+    ASSERT_TRUE(server.AddListening("127.0.0.1:50063"));
+    ASSERT_TRUE(server.Start());
+
+    int fd1 = test::ConnectLoopback(CONNECTION_ID_PORT);
+    ASSERT_GE(fd1, 0);
+    ASSERT_TRUE(test::WaitFor([&]() { return service.Connected().size() == 1; }));
+    ConnectionId old_cid = service.Connected()[0];
+    close(fd1);
+    ASSERT_TRUE(test::WaitFor([&]() { return service.Closed().size() == 1; }));
+
+    // The slot is freed once the last reference of the old
+    // connection is gone, until then a new one is refused
+    int fd2 = -1;
+    ASSERT_TRUE(test::WaitFor([&]() {
+        if (fd2 >= 0) {
+            close(fd2);
+        }
+        fd2 = test::ConnectLoopback(CONNECTION_ID_PORT);
+        return fd2 >= 0 && test::WaitFor(
+            [&]() { return service.Connected().size() == 2; }, 100);
+    }));
+    ConnectionId new_cid = service.Connected()[1];
+    ASSERT_EQ(core::GetUserId(new_cid), core::GetUserId(old_cid));
+    ASSERT_NE(new_cid, old_cid);
+
+    int marker = 0;
+    int stale = 0;
+    ASSERT_TRUE(server.SetUserData(new_cid, &marker));
+
+    const char package[] = { 0, 3, 'o', 'l', 'd' };
+    ASSERT_TRUE(!server.Send(old_cid, package, sizeof(package)));
+    ASSERT_TRUE(!server.SetUserData(old_cid, &stale));
+    ASSERT_TRUE(!server.CloseConnection(old_cid));
+
+    // The new connection is untouched
+    void* data = nullptr;
+    ASSERT_TRUE(server.GetUserData(new_cid, &data));
+    ASSERT_TRUE(data == &marker);
+
+    const char reply[] = { 0, 3, 'n', 'e', 'w' };
+    ASSERT_TRUE(server.Send(new_cid, reply, sizeof(reply)));
+    char in[sizeof(reply)];
+    ASSERT_EQ(test::RecvAll(fd2, in, sizeof(in)), sizeof(in));
+    ASSERT_EQ(memcmp(in, reply, sizeof(reply)), 0);
+    ASSERT_EQ(service.Closed().size(), 1u);
+
+    close(fd2);
+    server.Shutdown();
+}
+
+}  // namespace raptor
+
+int main(int argc, char** argv) {
+    return raptor::test::RunAllTests();
+}
@@ -0,0 +1,180 @@
+/*
+ *
+ * Copyright (c) 2020 The Raptor Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+// Echo through a loopback server. Every client writes all of its
+// messages before reading the echoes back, so the send buffers of the
+// server get deep. The elapsed time is printed, and with
+// RAPTOR_SLICE_REF_STATS the slice AddRef/DecRef calls per message
+// (each one delivered to the server and sent back).
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <thread>
+#include <vector>
+
+#include "core/slice/slice.h"
+#include "raptor/c.h"
+#include "raptor/protocol.h"
+#include "raptor/server.h"
+#include "util/testutil.h"
+#include "util/time.h"
+
+namespace raptor {
+namespace {
+
+constexpr int ECHO_PORT = 50061;
+constexpr size_t ECHO_CLIENTS = 16;
+constexpr size_t ECHO_MESSAGES = 3000;
+constexpr size_t ECHO_BODY_SIZE = 32;
+constexpr size_t ECHO_PACKAGE_SIZE = 2 + ECHO_BODY_SIZE;
+
+class EchoService final : public IServerReceiver {
+public:
+    void SetServer(ITcpServer* server) { _server = server; }
+
+    void OnConnected(ConnectionId cid, const char* peer) override {}
+    void OnClosed(ConnectionId cid) override {}
+    void OnMessageReceived(ConnectionId cid, const void* s, size_t len) override {
+        _server->Send(cid, s, len);
+    }
+
+private:
+    ITcpServer* _server = nullptr;
+};
+
+void FillPackage(uint8_t* p, size_t client, size_t index) {
+    p[0] = static_cast<uint8_t>(ECHO_BODY_SIZE >> 8);
+    p[1] = static_cast<uint8_t>(ECHO_BODY_SIZE & 0xff);
+    for (size_t i = 0; i < ECHO_BODY_SIZE; i++) {
+        p[2 + i] = static_cast<uint8_t>(client + index + i);
+    }
+}
+
+// Return the number of echoes that came back intact
+size_t RunClient(size_t client) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return 0;
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(ECHO_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return 0;
+    }
+
+    std::vector<uint8_t> out(ECHO_PACKAGE_SIZE * ECHO_MESSAGES);
+    for (size_t i = 0; i < ECHO_MESSAGES; i++) {
+        FillPackage(&out[i * ECHO_PACKAGE_SIZE], client, i);
+    }
+    size_t sent = 0;
+    while (sent < out.size()) {
+        ssize_t n = send(fd, &out[sent], out.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            close(fd);
+            return 0;
+        }
+        sent += static_cast<size_t>(n);
+    }
+
+    std::vector<uint8_t> in(out.size());
+    size_t received = 0;
+    while (received < in.size()) {
+        ssize_t n = recv(fd, &in[received], in.size() - received, 0);
+        if (n <= 0) {
+            break;
+        }
+        received += static_cast<size_t>(n);
+    }
+    close(fd);
+
+    size_t matched = 0;
+    for (size_t i = 0; i + ECHO_PACKAGE_SIZE <= received; i += ECHO_PACKAGE_SIZE) {
+        if (memcmp(&in[i], &out[i], ECHO_PACKAGE_SIZE) == 0) {
+            matched++;
+        }
+    }
+    return matched;
+}
+
+class EchoTest {};
+
+}  // namespace
+
+TEST(EchoTest, PipelinedClients) {
+    raptor_global_init();
+
+    raptor_framing_t framing;
+    memset(&framing, 0, sizeof(framing));
+    framing.type = RAPTOR_FRAMING_LENGTH16_BE;
+    FramingProtocol proto(framing);
+
+    RaptorOptions options;
+    memset(&options, 0, sizeof(options));
+    options.max_connections = 64;
+    options.connection_timeout = 60;
+
+    EchoService service;
+    Server server(&service);
+    service.SetServer(&server);
+    ASSERT_TRUE(server.Init(&options));
+    server.SetProtocol(&proto);
+    ASSERT_TRUE(server.AddListening("127.0.0.1:50061"));
+    ASSERT_TRUE(server.Start());
+
+    std::vector<size_t> matched(ECHO_CLIENTS, 0);
+    std::vector<std::thread> clients;
+#ifdef RAPTOR_SLICE_REF_STATS
+    uint64_t start_ops = GetSliceRefOps();
+#endif
+    int64_t start = GetCurrentMilliseconds();
+    for (size_t i = 0; i < ECHO_CLIENTS; i++) {
+        clients.emplace_back([&matched, i]() { matched[i] = RunClient(i); });
+    }
+    for (auto& t : clients) {
+        t.join();
+    }
+    int64_t elapsed = GetCurrentMilliseconds() - start;
+#ifdef RAPTOR_SLICE_REF_STATS
+    uint64_t ops = GetSliceRefOps() - start_ops;
+#endif
+    server.Shutdown();
+
+    fprintf(stderr, "echo: %zu clients x %zu messages in %lld ms\n",
+        ECHO_CLIENTS, ECHO_MESSAGES, static_cast<long long>(elapsed));
+#ifdef RAPTOR_SLICE_REF_STATS
+    fprintf(stderr, "echo: %.1f slice ref ops per message\n",
+        static_cast<double>(ops) / (ECHO_CLIENTS * ECHO_MESSAGES));
+#endif
+    for (size_t i = 0; i < ECHO_CLIENTS; i++) {
+        ASSERT_EQ(matched[i], ECHO_MESSAGES) << "client" << i;
+    }
+}
+
+}  // namespace raptor
+
+int main(int argc, char** argv) {
+    return raptor::test::RunAllTests();
+}
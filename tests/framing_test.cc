@@ -0,0 +1,138 @@
+/*
+ *
+ * Copyright (c) 2020 The Raptor Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <string.h>
+#include <string>
+
+#include "core/package_parser.h"
+#include "core/slice/slice.h"
+#include "core/slice/slice_buffer.h"
+#include "raptor/protocol.h"
+#include "util/testutil.h"
+
+namespace raptor {
+namespace {
+
+raptor_framing_t MakeFraming(raptor_framing_type_t type) {
+    raptor_framing_t f;
+    memset(&f, 0, sizeof(f));
+    f.type = type;
+    return f;
+}
+
+// Feed the chunks as separate slices, return the result of the last
+// Next call and the packages parsed before it
+int Parse(const raptor_framing_t& f,
+    const std::string* chunks, size_t count, std::string* packages) {
+    FramingProtocol proto(f);
+    PackageParser parser;
+    parser.SetProtocol(&proto);
+
+    SliceBuffer buf;
+    int r = 0;
+    for (size_t i = 0; i < count; i++) {
+        buf.AddSlice(Slice(chunks[i].data(), chunks[i].size()));
+        Slice package;
+        while ((r = parser.Next(&buf, &package)) > 0) {
+            packages->append(reinterpret_cast<const char*>(package.begin()), package.size());
+            packages->push_back('|');
+        }
+        if (r < 0) {
+            break;
+        }
+    }
+    return r;
+}
+
+class FramingTest {};
+
+}  // namespace
+
+TEST(FramingTest, VarintLongerThanFiveBytes) {
+    raptor_framing_t f = MakeFraming(RAPTOR_FRAMING_VARINT);
+    std::string chunks[] = { std::string("\x80\x80\x80\x80\x80\x01", 6) };
+    std::string packages;
+    ASSERT_EQ(Parse(f, chunks, 1, &packages), -1);
+    ASSERT_TRUE(packages.empty());
+}
+
+TEST(FramingTest, VarintSplitAcrossSlices) {
+    raptor_framing_t f = MakeFraming(RAPTOR_FRAMING_VARINT);
+    // 130 body bytes, the varint 0x82 0x01 spans two slices
+    std::string body(130, 'x');
+    std::string chunks[] = { std::string("\x82", 1), std::string("\x01", 1) + body };
+    std::string packages;
+    ASSERT_EQ(Parse(f, chunks, 2, &packages), 0);
+    ASSERT_EQ(packages, std::string("\x82\x01", 2) + body + "|");
+}
+
+TEST(FramingTest, LengthIncludingHeaderBelowHeaderSize) {
+    raptor_framing_t f = MakeFraming(RAPTOR_FRAMING_LENGTH16_BE);
+    f.length_includes_header = 1;
+    std::string chunks[] = { std::string("\x00\x01", 2) };
+    std::string packages;
+    ASSERT_EQ(Parse(f, chunks, 1, &packages), -1);
+}
+
+TEST(FramingTest, LengthIncludingHeader) {
+    raptor_framing_t f = MakeFraming(RAPTOR_FRAMING_LENGTH32_LE);
+    f.length_includes_header = 1;
+    std::string chunks[] = { std::string("\x06\x00\x00\x00" "ab" "\x04\x00\x00\x00", 10) };
+    std::string packages;
+    ASSERT_EQ(Parse(f, chunks, 1, &packages), 0);
+    ASSERT_EQ(packages, std::string("\x06\x00\x00\x00" "ab|" "\x04\x00\x00\x00|", 12));
+}
+
+TEST(FramingTest, MaxPackageSize) {
+    raptor_framing_t f = MakeFraming(RAPTOR_FRAMING_LENGTH16_BE);
+    f.max_package_size = 10;
+
+    std::string fits[] = { std::string("\x00\x08", 2) + std::string(8, 'a') };
+    std::string packages;
+    ASSERT_EQ(Parse(f, fits, 1, &packages), 0);
+    ASSERT_EQ(packages.size(), 11u);
+
+    std::string too_long[] = { std::string("\x00\x09", 2) };
+    packages.clear();
+    ASSERT_EQ(Parse(f, too_long, 1, &packages), -1);
+}
+
+TEST(FramingTest, DelimiterSplitAcrossSlices) {
+    raptor_framing_t f = MakeFraming(RAPTOR_FRAMING_DELIMITER);
+    f.delimiter = '\n';
+    std::string chunks[] = { "hel", "lo\nwor", "l", "d\n" };
+    std::string packages;
+    ASSERT_EQ(Parse(f, chunks, 4, &packages), 0);
+    ASSERT_EQ(packages, std::string("hello\n|world\n|"));
+}
+
+TEST(FramingTest, DelimiterBeyondMaxPackageSize) {
+    raptor_framing_t f = MakeFraming(RAPTOR_FRAMING_DELIMITER);
+    f.delimiter = '\n';
+    f.max_package_size = 8;
+    std::string chunks[] = { "abcd", "efghij\n" };
+    std::string packages;
+    ASSERT_EQ(Parse(f, chunks, 2, &packages), -1);
+    ASSERT_TRUE(packages.empty());
+}
+
+}  // namespace raptor
+
+int main(int argc, char** argv) {
+    return raptor::test::RunAllTests();
+}
@@ -0,0 +1,162 @@
+/*
+ *
+ * Copyright (c) 2020 The Raptor Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __RAPTOR_TESTS_LOOPBACK__
+#define __RAPTOR_TESTS_LOOPBACK__
+
+// Helpers of the tests that run a server on the loopback interface
+// and talk to it through plain blocking sockets.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "raptor/service.h"
+#include "raptor/types.h"
+#include "util/time.h"
+
+namespace raptor {
+namespace test {
+
+// rcvbuf > 0 shrinks the receive buffer of the client
+inline int ConnectLoopback(int port, int rcvbuf = 0) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (rcvbuf > 0) {
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+inline bool SendAll(int fd, const void* data, size_t len) {
+    const char* p = static_cast<const char*>(data);
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// Return the number of bytes read, less than len if the peer closed
+inline size_t RecvAll(int fd, void* data, size_t len) {
+    char* p = static_cast<char*>(data);
+    size_t received = 0;
+    while (received < len) {
+        ssize_t n = recv(fd, p + received, len - received, 0);
+        if (n <= 0) {
+            break;
+        }
+        received += static_cast<size_t>(n);
+    }
+    return received;
+}
+
+// Poll pred every millisecond, return false if it is still
+// false after timeout_ms
+inline bool WaitFor(const std::function<bool()>& pred, int64_t timeout_ms = 5000) {
+    int64_t deadline = GetCurrentMilliseconds() + timeout_ms;
+    while (!pred()) {
+        if (GetCurrentMilliseconds() > deadline) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+// Records the callbacks of the server, safe to read from the test thread
+class RecordingService : public IServerReceiver {
+public:
+    void OnConnected(ConnectionId cid, const char* peer) override {
+        std::lock_guard<std::mutex> g(_mtx);
+        _connected.push_back(cid);
+    }
+    void OnMessageReceived(ConnectionId cid, const void* s, size_t len) override {
+        std::lock_guard<std::mutex> g(_mtx);
+        _messages++;
+    }
+    void OnClosed(ConnectionId cid) override {
+        std::lock_guard<std::mutex> g(_mtx);
+        _closed.push_back(cid);
+    }
+    void OnWritable(ConnectionId cid) override {
+        std::lock_guard<std::mutex> g(_mtx);
+        _writable.push_back(cid);
+    }
+
+    std::vector<ConnectionId> Connected() {
+        std::lock_guard<std::mutex> g(_mtx);
+        return _connected;
+    }
+    std::vector<ConnectionId> Closed() {
+        std::lock_guard<std::mutex> g(_mtx);
+        return _closed;
+    }
+    std::vector<ConnectionId> Writable() {
+        std::lock_guard<std::mutex> g(_mtx);
+        return _writable;
+    }
+    size_t Messages() {
+        std::lock_guard<std::mutex> g(_mtx);
+        return _messages;
+    }
+
+protected:
+    std::mutex _mtx;
+
+private:
+    std::vector<ConnectionId> _connected;
+    std::vector<ConnectionId> _closed;
+    std::vector<ConnectionId> _writable;
+    size_t _messages = 0;
+};
+
+inline raptor_framing_t MakeLength16Framing() {
+    raptor_framing_t f;
+    memset(&f, 0, sizeof(f));
+    f.type = RAPTOR_FRAMING_LENGTH16_BE;
+    return f;
+}
+
+}  // namespace test
+}  // namespace raptor
+
+#endif  // __RAPTOR_TESTS_LOOPBACK__
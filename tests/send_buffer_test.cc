@@ -0,0 +1,98 @@
+/*
+ *
+ * Copyright (c) 2020 The Raptor Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+// A client that stops reading makes the send buffer of its connection
+// fill up to max_send_buffer_size. Send then fails, and OnWritable
+// arrives once when the client reads again.
+
+#include <string.h>
+#include <vector>
+
+#include "raptor/c.h"
+#include "raptor/protocol.h"
+#include "raptor/server.h"
+#include "tests/loopback.h"
+#include "util/testutil.h"
+
+namespace raptor {
+namespace {
+
+constexpr int SEND_BUFFER_PORT = 50062;
+constexpr size_t MAX_SEND_BUFFER = 64 * 1024;
+constexpr size_t CHUNK_SIZE = 4096;
+// far more than the kernel buffers of a loopback connection hold
+constexpr size_t MAX_CHUNKS = 64 * 1024;
+
+class SendBufferTest {};
+
+}  // namespace
+
+TEST(SendBufferTest, FailsWhenFullAndNotifiesOnceDrained) {
+    raptor_global_init();
+
+    FramingProtocol proto(test::MakeLength16Framing());
+    RaptorOptions options;
+    memset(&options, 0, sizeof(options));
+    options.connection_timeout = 60;
+    options.max_send_buffer_size = MAX_SEND_BUFFER;
+
+    test::RecordingService service;
+    Server server(&service);
+    ASSERT_TRUE(server.Init(&options));
+    server.SetProtocol(&proto);
+    ASSERT_TRUE(server.AddListening("127.0.0.1:50062"));
+    ASSERT_TRUE(server.Start());
+
+    int fd = test::ConnectLoopback(SEND_BUFFER_PORT, 4096);
+    ASSERT_GE(fd, 0);
+    ASSERT_TRUE(test::WaitFor([&]() { return service.Connected().size() == 1; }));
+    ConnectionId cid = service.Connected()[0];
+
+    // The client reads nothing yet
+    std::vector<char> chunk(CHUNK_SIZE, 'r');
+    size_t accepted = 0;
+    bool rejected = false;
+    for (size_t i = 0; i < MAX_CHUNKS; i++) {
+        if (!server.Send(cid, chunk.data(), chunk.size())) {
+            rejected = true;
+            break;
+        }
+        accepted += chunk.size();
+    }
+    ASSERT_TRUE(rejected);
+    ASSERT_TRUE(service.Writable().empty());
+
+    std::vector<char> in(accepted);
+    ASSERT_EQ(test::RecvAll(fd, in.data(), in.size()), accepted);
+    ASSERT_TRUE(test::WaitFor([&]() { return !service.Writable().empty(); }));
+
+    // Nothing else was rejected, no second notification follows
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    ASSERT_EQ(service.Writable().size(), 1u);
+    ASSERT_EQ(service.Writable()[0], cid);
+    ASSERT_TRUE(server.Send(cid, chunk.data(), chunk.size()));
+
+    close(fd);
+    server.Shutdown();
+}
+
+}  // namespace raptor
+
+int main(int argc, char** argv) {
+    return raptor::test::RunAllTests();
+}
@@ -20,10 +20,24 @@
 #include <stdlib.h>
 
 namespace raptor {
+namespace {
+const raptor_allocator_t g_default_allocator = {
+    ::malloc, ::calloc, ::realloc, ::free
+};
+
+// Constant initialized, usable by any static constructor
+raptor_allocator_t g_allocator = { ::malloc, ::calloc, ::realloc, ::free };
+raptor_allocator_t g_buffer_allocator = { ::malloc, ::calloc, ::realloc, ::free };
+} // namespace
+
+void SetAllocator(const raptor_allocator_t* general, const raptor_allocator_t* buffers) {
+    g_allocator = general ? *general : g_default_allocator;
+    g_buffer_allocator = buffers ? *buffers : g_allocator;
+}
 
 void* Malloc(size_t size) {
     if (size > 0) {
-        void* ptr = ::malloc(size);
+        void* ptr = g_allocator.malloc_fn(size);
         if (!ptr) {
             abort();
         }
@@ -34,7 +48,7 @@ void* Malloc(size_t size) {
 
 void* ZeroAlloc(size_t size) {
     if (size > 0) {
-        void* p = ::calloc(size, 1);
+        void* p = g_allocator.calloc_fn(size, 1);
         if (!p) {
             abort();
         }
@@ -47,7 +61,7 @@ void* Realloc(void* ptr, size_t size) {
     if ((size == 0) && (ptr == nullptr)) {
         return nullptr;
     }
-    ptr = ::realloc(ptr, size);
+    ptr = g_allocator.realloc_fn(ptr, size);
     if (!ptr) {
         abort();
     }
@@ -55,7 +69,22 @@ void* Realloc(void* ptr, size_t size) {
 }
 
 void Free(void* ptr) {
-    if (ptr) free(ptr);
+    if (ptr) g_allocator.free_fn(ptr);
+}
+
+void* BufferMalloc(size_t size) {
+    if (size > 0) {
+        void* ptr = g_buffer_allocator.malloc_fn(size);
+        if (!ptr) {
+            abort();
+        }
+        return ptr;
+    }
+    return nullptr;
+}
+
+void BufferFree(void* ptr) {
+    if (ptr) g_buffer_allocator.free_fn(ptr);
 }
 
 } // namespace raptor
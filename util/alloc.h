@@ -20,6 +20,8 @@
 #define __RAPTOR_UTIL_ALLOC__
 
 #include <stddef.h>
+#include <new>
+#include "raptor/types.h"
 
 namespace raptor {
 
@@ -28,6 +30,44 @@ void* ZeroAlloc(size_t size);
 void* Realloc(void* ptr, size_t size);
 void  Free(void* ptr);
 
+// Memory of the packet buffers
+void* BufferMalloc(size_t size);
+void  BufferFree(void* ptr);
+
+// nullptr general restores the defaults,
+// nullptr buffers makes them use general
+void SetAllocator(const raptor_allocator_t* general, const raptor_allocator_t* buffers);
+
+// Derive from it to allocate the objects through Malloc/Free
+class AllocatedObject {
+public:
+    static void* operator new(size_t size) { return Malloc(size); }
+    static void* operator new[](size_t size) { return Malloc(size); }
+    static void* operator new(size_t, void* ptr) { return ptr; }
+    static void operator delete(void* ptr) { Free(ptr); }
+    static void operator delete[](void* ptr) { Free(ptr); }
+    static void operator delete(void*, void*) {}
+};
+
+// std allocator over Malloc/Free, e.g. for std::allocate_shared
+template <typename T>
+class StdAllocator {
+public:
+    using value_type = T;
+
+    StdAllocator() = default;
+    template <typename U>
+    StdAllocator(const StdAllocator<U>&) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(Malloc(n * sizeof(T))); }
+    void deallocate(T* ptr, size_t) { Free(ptr); }
+
+    template <typename U>
+    bool operator==(const StdAllocator<U>&) const { return true; }
+    template <typename U>
+    bool operator!=(const StdAllocator<U>&) const { return false; }
+};
+
 } // namespace raptor
 
 #endif  // __RAPTOR_UTIL_ALLOC__
@@ -142,10 +142,20 @@ void LogFormatPrint(
     ret = vsnprintf_s(message, buff_len, _TRUNCATE, format, args);
     va_end(args);
 #else
-    if (vasprintf(&message, format, args) == -1) {  // stdio.h
+    // Not vasprintf, the message must come from Malloc
+    va_list copy;
+    va_copy(copy, args);
+    int ret = vsnprintf(NULL, 0, format, copy);
+    va_end(copy);
+    if (ret < 0) {
         va_end(args);
         return;
     }
+
+    size_t buff_len = (size_t)ret + 1;
+    message = (char*)Malloc(buff_len);
+    vsnprintf(message, buff_len, format, args);
+    va_end(args);
 #endif
 
     if (g_min_level.Load() <= static_cast<intptr_t>(level)) {
@@ -0,0 +1,275 @@
+/*
+ *
+ * Copyright (c) 2020 The Raptor Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "util/slab.h"
+#include <string.h>
+#include "util/alloc.h"
+#include "util/atomic.h"
+#include "util/sync.h"
+
+namespace raptor {
+namespace {
+
+constexpr size_t SLAB_MIN_BLOCK_SIZE = 64;
+constexpr size_t SLAB_CLASS_COUNT = RAPTOR_SLAB_CLASS_COUNT;
+constexpr uint32_t SLAB_LARGE_CLASS = static_cast<uint32_t>(-1);
+
+// A thread keeps at most this many bytes of free blocks per class
+constexpr size_t SLAB_MAX_CACHED_BYTES = 1024 * 1024;
+
+struct SlabCache;
+
+// Precedes the memory handed out, keeps it 16-byte aligned
+struct alignas(16) SlabHeader {
+    SlabCache* owner;
+    uint32_t size_class;
+};
+
+// Overlays the memory of a free block
+struct FreeBlock {
+    FreeBlock* next;
+};
+
+// Left in the remote list of a released cache, remote frees
+// that see it give the block back to the system instead
+FreeBlock* const SLAB_DEAD_LIST = reinterpret_cast<FreeBlock*>(1);
+
+struct SlabClass {
+    FreeBlock* head;
+    size_t cached;
+
+    // blocks freed by other threads
+    Atomic<FreeBlock*> remote;
+
+    // only written by the thread holding the cache
+    AtomicUInt64 allocs;
+    AtomicUInt64 frees;
+    AtomicUInt64 remote_frees;
+    AtomicUInt64 system_allocs;
+};
+
+struct SlabCache {
+    SlabClass classes[SLAB_CLASS_COUNT];
+    SlabCache* next;
+};
+
+// Caches are never destroyed, blocks may outlive their thread.
+// The cache of an exited thread is adopted by the next new one.
+struct SlabRegistry {
+    Mutex mtx;
+    SlabCache* all;
+    SlabCache* orphans[64];
+    size_t orphan_count;
+};
+
+SlabRegistry* GetRegistry() {
+    static SlabRegistry* registry = new (ZeroAlloc(sizeof(SlabRegistry))) SlabRegistry();
+    return registry;
+}
+
+inline size_t ClassBlockSize(size_t index) {
+    return SLAB_MIN_BLOCK_SIZE << index;
+}
+
+inline uint32_t SizeToClass(size_t size) {
+    size_t block_size = SLAB_MIN_BLOCK_SIZE;
+    for (uint32_t i = 0; i < SLAB_CLASS_COUNT; i++) {
+        if (size <= block_size) {
+            return i;
+        }
+        block_size <<= 1;
+    }
+    return SLAB_LARGE_CLASS;
+}
+
+inline void ReleaseBlock(FreeBlock* b) {
+    BufferFree(reinterpret_cast<SlabHeader*>(b) - 1);
+}
+
+inline void Increment(AtomicUInt64& counter) {
+    counter.Store(counter.Load(MemoryOrder::RELAXED) + 1, MemoryOrder::RELAXED);
+}
+
+SlabCache* AcquireCache() {
+    SlabRegistry* r = GetRegistry();
+    AutoMutex g(&r->mtx);
+    if (r->orphan_count > 0) {
+        return r->orphans[--r->orphan_count];
+    }
+    SlabCache* cache = new (ZeroAlloc(sizeof(SlabCache))) SlabCache();
+    for (size_t i = 0; i < SLAB_CLASS_COUNT; i++) {
+        cache->classes[i].head = nullptr;
+        cache->classes[i].cached = 0;
+        cache->classes[i].remote.Store(nullptr);
+    }
+    cache->next = r->all;
+    r->all = cache;
+    return cache;
+}
+
+void ReleaseCache(SlabCache* cache) {
+    SlabRegistry* r = GetRegistry();
+    AutoMutex g(&r->mtx);
+    if (r->orphan_count < sizeof(r->orphans) / sizeof(r->orphans[0])) {
+        r->orphans[r->orphan_count++] = cache;
+        return;
+    }
+
+    // Too many idle caches, give their free blocks back.
+    // The cache stays dead, blocks freed to it later go to the system.
+    for (size_t i = 0; i < SLAB_CLASS_COUNT; i++) {
+        SlabClass* c = &cache->classes[i];
+        while (c->head) {
+            FreeBlock* b = c->head;
+            c->head = b->next;
+            ReleaseBlock(b);
+        }
+        c->cached = 0;
+
+        FreeBlock* list = c->remote.Exchange(SLAB_DEAD_LIST, MemoryOrder::ACQUIRE);
+        while (list) {
+            FreeBlock* b = list;
+            list = list->next;
+            ReleaseBlock(b);
+        }
+    }
+}
+
+class ThreadCache final {
+public:
+    ThreadCache() : _cache(AcquireCache()) {}
+    ~ThreadCache() { ReleaseCache(_cache); }
+    SlabCache* Get() const { return _cache; }
+
+private:
+    SlabCache* _cache;
+};
+
+SlabCache* GetThreadCache() {
+    static thread_local ThreadCache tc;
+    return tc.Get();
+}
+
+} // namespace
+
+void* SlabAlloc(size_t size) {
+    uint32_t index = SizeToClass(size);
+    if (index == SLAB_LARGE_CLASS) {
+        SlabHeader* hdr = static_cast<SlabHeader*>(BufferMalloc(sizeof(SlabHeader) + size));
+        hdr->owner = nullptr;
+        hdr->size_class = SLAB_LARGE_CLASS;
+        return hdr + 1;
+    }
+
+    SlabCache* cache = GetThreadCache();
+    SlabClass* c = &cache->classes[index];
+    Increment(c->allocs);
+
+    if (c->head == nullptr) {
+        // Take back what other threads have freed, up to the cap
+        size_t max_cached = SLAB_MAX_CACHED_BYTES / ClassBlockSize(index);
+        FreeBlock* list = c->remote.Exchange(nullptr, MemoryOrder::ACQUIRE);
+        while (list) {
+            FreeBlock* b = list;
+            list = list->next;
+            if (c->cached >= max_cached) {
+                ReleaseBlock(b);
+                continue;
+            }
+            b->next = c->head;
+            c->head = b;
+            c->cached++;
+        }
+    }
+
+    if (c->head) {
+        FreeBlock* b = c->head;
+        c->head = b->next;
+        c->cached--;
+        return b;
+    }
+
+    Increment(c->system_allocs);
+    SlabHeader* hdr = static_cast<SlabHeader*>(
+        BufferMalloc(sizeof(SlabHeader) + ClassBlockSize(index)));
+    hdr->owner = cache;
+    hdr->size_class = index;
+    return hdr + 1;
+}
+
+void SlabFree(void* ptr) {
+    if (!ptr) return;
+    SlabHeader* hdr = static_cast<SlabHeader*>(ptr) - 1;
+    if (hdr->size_class == SLAB_LARGE_CLASS) {
+        BufferFree(hdr);
+        return;
+    }
+
+    SlabCache* cache = GetThreadCache();
+    SlabClass* local = &cache->classes[hdr->size_class];
+    FreeBlock* b = static_cast<FreeBlock*>(ptr);
+    Increment(local->frees);
+
+    if (hdr->owner != cache) {
+        Increment(local->remote_frees);
+        SlabClass* c = &hdr->owner->classes[hdr->size_class];
+        FreeBlock* head = c->remote.Load(MemoryOrder::RELAXED);
+        do {
+            if (head == SLAB_DEAD_LIST) {
+                BufferFree(hdr);
+                return;
+            }
+            b->next = head;
+        } while (!c->remote.CompareExchangeWeak(
+            &head, b, MemoryOrder::RELEASE, MemoryOrder::RELAXED));
+        return;
+    }
+
+    if (local->cached * ClassBlockSize(hdr->size_class) >= SLAB_MAX_CACHED_BYTES) {
+        BufferFree(hdr);
+        return;
+    }
+    b->next = local->head;
+    local->head = b;
+    local->cached++;
+}
+
+size_t SlabGetStats(raptor_slab_stats_t* stats, size_t count) {
+    if (count > SLAB_CLASS_COUNT) {
+        count = SLAB_CLASS_COUNT;
+    }
+    memset(stats, 0, sizeof(raptor_slab_stats_t) * count);
+    for (size_t i = 0; i < count; i++) {
+        stats[i].block_size = ClassBlockSize(i);
+    }
+
+    SlabRegistry* r = GetRegistry();
+    AutoMutex g(&r->mtx);
+    for (SlabCache* cache = r->all; cache != nullptr; cache = cache->next) {
+        for (size_t i = 0; i < count; i++) {
+            SlabClass* c = &cache->classes[i];
+            stats[i].allocs += c->allocs.Load();
+            stats[i].frees += c->frees.Load();
+            stats[i].remote_frees += c->remote_frees.Load();
+            stats[i].system_allocs += c->system_allocs.Load();
+        }
+    }
+    return count;
+}
+
+} // namespace raptor
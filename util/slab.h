@@ -0,0 +1,39 @@
+/*
+ *
+ * Copyright (c) 2020 The Raptor Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __RAPTOR_UTIL_SLAB__
+#define __RAPTOR_UTIL_SLAB__
+
+#include <stddef.h>
+#include "raptor/types.h"
+
+namespace raptor {
+
+// Size-class allocator for packet buffers. Freed blocks are cached
+// by the thread that allocated them; a block freed by another thread
+// goes back to its owner through a lock-free list. Requests larger
+// than the biggest class fall through to BufferMalloc.
+void* SlabAlloc(size_t size);
+void  SlabFree(void* ptr);
+
+// Fill up to count entries, return the number of size classes
+size_t SlabGetStats(raptor_slab_stats_t* stats, size_t count);
+
+} // namespace raptor
+
+#endif  // __RAPTOR_UTIL_SLAB__
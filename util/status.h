@@ -26,7 +26,8 @@
 #include "util/ref_counted.h"
 
 namespace raptor {
-class Status final : public RefCounted<Status, NonPolymorphicRefCount> {
+class Status final : public RefCounted<Status, NonPolymorphicRefCount>
+                   , public AllocatedObject {
 public:
     Status();
     Status(const std::string& msg);